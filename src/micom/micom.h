@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The MICOM commands of the SERVO IC (KB9223) and the DSP IC (KS9286B) - This
+// header is shared by the sender, the sniffer and any tool on the host, so it
+// must not depend on the SDK.
+//
+// Commands are grouped by their upper 4 bits, the address of the register they
+// write, as each group has a single length and target IC. The 8 bit commands
+// are written to the SERVO IC (0x0X to 0x3X) and to the DSP IC (0x4X to 0xEX);
+// the 12 bit commands (0x8XX) are the extended commands of the SERVO IC, which
+// are grouped by their middle 4 bits. The lower 4 bits are the data, except for
+// the groups of 12 bit commands carrying a 5 bit value, which take up 2 groups.
+//
+// A command either completes as soon as the latch signal is triggered or keeps
+// SENS low until it is completed, which is given per data value as a mask.
+
+// Target ICs of the commands
+enum kMicomIc {
+  MICOM_SERVO = 0,  // KB9223
+  MICOM_DSP,        // KS9286B
+};
+
+//  Bits  Group  IC           SENS mask  Mnemonic
+#define MICOM_COMMANDS(X) \
+  X( 8, 0x00 , MICOM_SERVO, 0x0000   , "FOCUS"          ) /* Focus control - 0x08 focus on */ \
+  X( 8, 0x10 , MICOM_SERVO, 0x0000   , "TRACKING"       ) /* Anti-shock, brake and gain */ \
+  X( 8, 0x20 , MICOM_SERVO, 0x0000   , "TRACKING_MODE"  ) /* Tracking and sled servos, kicks */ \
+  X( 8, 0x30 , MICOM_SERVO, 0x0000   , "SELECT"         ) \
+  X( 8, 0x40 , MICOM_DSP  , 0xFFFE   , "AUTO_SEQUENCE"  ) /* 0x40 cancels, 0x47 focus, jumps */ \
+  X( 8, 0x50 , MICOM_DSP  , 0x0000   , "BLIND_BRAKE"    ) /* Jump timings */ \
+  X( 8, 0x60 , MICOM_DSP  , 0x0000   , "KICK"           ) \
+  X( 8, 0x70 , MICOM_DSP  , 0x0000   , "JUMP_COUNT"     ) \
+  X( 8, 0x80 , MICOM_DSP  , 0x0000   , "MODE"           ) \
+  X( 8, 0x90 , MICOM_DSP  , 0x0000   , "CNTL_Z"         ) /* Function */ \
+  X( 8, 0xA0 , MICOM_DSP  , 0x0000   , "CNTL_S"         ) /* Audio control */ \
+  X( 8, 0xB0 , MICOM_DSP  , 0x0000   , "TRAVERSE"       ) \
+  X( 8, 0xC0 , MICOM_DSP  , 0x0000   , "SPINDLE"        ) \
+  X( 8, 0xD0 , MICOM_DSP  , 0x0000   , "CLV_CONTROL"    ) \
+  X( 8, 0xE0 , MICOM_DSP  , 0x0000   , "CNTL_C"         ) /* CLV mode - 0xe0 stops */ \
+  X(12, 0x800, MICOM_SERVO, 0x0000   , "BALANCE"        ) /* 0x800 | balance */ \
+  X(12, 0x810, MICOM_SERVO, 0x0000   , "BALANCE"        ) \
+  X(12, 0x820, MICOM_SERVO, 0x0000   , "GAIN"           ) /* 0x820 | gain */ \
+  X(12, 0x830, MICOM_SERVO, 0x0000   , "GAIN"           ) \
+  X(12, 0x840, MICOM_SERVO, 0x0006   , "AUTO_ADJUST"    ) /* 0x841 and 0x842 adjust, 0x844 and 0x848 select windows */ \
+  X(12, 0x850, MICOM_SERVO, 0x0000   , "LASER"          ) /* 0x854 on, 0x85c off */ \
+  X(12, 0x860, MICOM_SERVO, 0x0000   , "OFFSET_CANCEL"  ) \
+  X(12, 0x870, MICOM_SERVO, 0x0000   , "FOCUS_BIAS"     )
+
+// A group of commands
+typedef struct {
+  uint8_t     bits;       // Length in bits - 0 if the group is unknown
+  uint8_t     ic;         // One of kMicomIc
+  uint16_t    group;      // First command of the group
+  uint16_t    sens_mask;  // Bit N set if the command group | N keeps SENS low
+  const char* mnemonic;
+} TMicomCommand;
+
+// Number of groups of each length, indexed by their address
+#define MICOM_GROUPS        16
+
+// Macro for getting the index of the group of a command in the table
+#define MICOM_INDEX(bits, command) \
+  (((bits) == 12 ? MICOM_GROUPS : 0) + (((command) >> 4) & 0xF))
+
+// The table is built at compile time and is visible to the compiler so a lookup
+// of a constant command is folded into a constant
+#define MICOM_ENTRY(b, g, i, s, m) \
+  [MICOM_INDEX(b, g)] = { .bits = (b), .ic = (i), .group = (g), .sens_mask = (s), .mnemonic = (m) },
+
+static const TMicomCommand micom_commands[2 * MICOM_GROUPS] = {
+  MICOM_COMMANDS(MICOM_ENTRY)
+};
+
+#undef MICOM_ENTRY
+
+/**
+ * Looks up a command given its length in bits.
+ *
+ * @returns the group of the command; NULL, if the command is not known.
+ */
+static inline const TMicomCommand* micom_decode(uint16_t command, uint8_t bits) {
+  const TMicomCommand* c;
+
+  if (bits == 8 && command <= 0xFF) {
+    c = &micom_commands[MICOM_INDEX(8, command)];
+  } else if (bits == 12 && (command >> 8) == 0x8) {
+    c = &micom_commands[MICOM_INDEX(12, command)];
+  } else {
+    return NULL;
+  }
+
+  return c->bits != 0 ? c : NULL;
+}
+
+/**
+ * Gets the length in bits of a command.
+ *
+ * The length of a command not known is derived from its value, as the shortest
+ * length of 8, 12 or 16 bits holding it.
+ */
+static inline uint8_t micom_bits(uint16_t command) {
+  if (micom_decode(command, 8) != NULL) {
+    return 8;
+  }
+
+  if (micom_decode(command, 12) != NULL) {
+    return 12;
+  }
+
+  return command <= 0xFF ? 8 : command <= 0xFFF ? 12 : 16;
+}
+
+/**
+ * Indicates whether a command keeps SENS low until it is completed.
+ */
+static inline bool micom_is_sens(uint16_t command, uint8_t bits) {
+  const TMicomCommand* c = micom_decode(command, bits);
+
+  return c != NULL && ((c->sens_mask >> (command & 0xF)) & 0x1) != 0;
+}
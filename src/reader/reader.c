@@ -1,3 +1,5 @@
+#include "reader.h"
+
 // ESP8266
 #include "rom/ets_sys.h"
 #include "esp8266/spi_struct.h"
@@ -5,9 +7,12 @@
 #include "esp8266/timer_struct.h"
 #include "driver/gpio.h"
 #include "driver/hw_timer.h"
+#include "driver/soc.h"
 
 // ESP SDK
 #include "esp_attr.h"
+#include "nvs.h"
+#include "nvs_flash.h"
 
 // FreeRTOS
 #include "FreeRTOS.h"
@@ -37,24 +42,75 @@
 // Clock divider must be set to TIMER_CLKDIV_16
 #define US_TO_TICKS(t) ((80000000 >> frc1.ctrl.div) / 1000000) * t
 
+// Macro for converting a value given in CPU cycles to uS
+#define CYCLES_TO_US(c) ((c) / CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ)
+
 // The size of the circular buffer
 #define BUFFER_SIZE 3 * 4096
 
+// Watchdog thresholds - A subcode frame is received every 1 / 75 s (13.3 mS) so
+// the lock is considered lost after a few frame periods without a SCOR edge or
+// after a few consecutive frames failing the CRC check
+#define FRAME_PERIOD_US         13333
+#define WATCHDOG_SCOR_FRAMES    3
+#define WATCHDOG_CRC_ERRORS     4
+
+// Maximum number of registered listeners allowed
+#define MAX_LISTENERS           2
+
+// SQCK calibration - Each step is measured for a period of time and accepted if
+// the pass rate does not drop below the one measured at the default clock minus
+// a small tolerance given in per mille
+#define SQCK_DEFAULT_STEP       0
+#define SQCK_STEP_FRAMES        150 // 2 seconds
+#define SQCK_STEP_TIMEOUT_MS    4000 // The measure fails if SCOR stops meanwhile
+#define SQCK_TOLERANCE_PM       5
+
+// Storage for the calibrated SQCK
+#define NVS_NAMESPACE           "reader"
+#define NVS_KEY_SQCK            "sqck"
+
+// Values for the SPI clock counter - SQCK = 40 MHz / (N + 1) - ordered from the
+// slowest to the fastest clock
+static const uint8_t sqck_steps[] = { 39, 19, 15, 9, 7, 4, 3 };
+
 static DRAM_ATTR uint32_t buffer[BUFFER_SIZE];  // The circular buffer
 static IRAM_ATTR size_t   read_index;           // The read index of the circular buffer
 static IRAM_ATTR size_t   write_index;          // The write index of the circular buffer
 
+static DRAM_ATTR volatile TickType_t scor_ticks; // The tick count at the last SCOR edge - Unlike the CPU
+                                                 // cycle count, it does not wrap in any realistic time
+static DRAM_ATTR volatile uint32_t crc_errors;  // Number of consecutive frames failing the CRC check
+static DRAM_ATTR volatile uint32_t scor_count;  // Number of SCOR edges received
+static DRAM_ATTR volatile uint32_t read_count;  // Number of frames read through the SPI
+static DRAM_ATTR volatile uint32_t read_cycles; // Total CPU cycles spent reading frames through the SPI
+
+static uint8_t         sqck_step       = SQCK_DEFAULT_STEP;
+
+static uint8_t         watchdog_status = R_LOCK_LOST_SCOR;
+static TickType_t      watchdog_ticks  = 0;
+static size_t          n_listeners     = 0;
+static rdr_listener_t  listeners[MAX_LISTENERS];
+
 static void IRAM_ATTR frc_timer_isr_cb() {
   frc1.ctrl.en = 0;
 }
 
 static void IRAM_ATTR gpio_handler() {
+  uint32_t scor_cycles;
+
   if (GPIO.status & BIT(SCOR_PORT)) {
     GPIO.status_w1tc = BIT(SCOR_PORT);
 
+    scor_cycles = soc_get_ccount();
+    scor_ticks  = xTaskGetTickCountFromISR();
+    scor_count++;
+
     PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDI_U, FUNC_GPIO12);
 
     if (((GPIO.in >> GPIO_NUM_12) & 0x1) == /* CRC OK */ 1) {
+      crc_errors = 0;
+
       PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDI_U, FUNC_HSPIQ_MISO);
 
       // Enable the read phase
@@ -68,6 +124,9 @@ static void IRAM_ATTR gpio_handler() {
 
       while (SPI1.cmd.usr == 1);
 
+      read_cycles += soc_get_ccount() - scor_cycles;
+      read_count++;
+
       if (write_index != read_index || read_index == 0) {
         if ((REVERSE(( SPI1.data_buf[0] >> 24) & 0xf)) == /* Mode 1 */ 1) {
           buffer[write_index++] = SPI1.data_buf[0];
@@ -79,10 +138,74 @@ static void IRAM_ATTR gpio_handler() {
           }
         }
       }
+    } else {
+      crc_errors++;
     }
   }
 }
 
+static void IRAM_ATTR notify_event(uint8_t type, uint32_t elapsed_ms) {
+  TReaderEvent event;
+
+  event.type       = type;
+  event.elapsed_ms = elapsed_ms;
+
+  for (size_t i = 0; i < n_listeners; i++) {
+    listeners[i](&event);
+  }
+}
+
+static void IRAM_ATTR check_watchdog() {
+  TickType_t now;
+  TickType_t last_scor;
+  uint32_t   errors;
+  uint8_t    status;
+
+  // Take a consistent snapshot of the values written by the SCOR interrupt
+  portENTER_CRITICAL();
+
+  now       = xTaskGetTickCount();
+  last_scor = scor_ticks;
+  errors    = crc_errors;
+
+  portEXIT_CRITICAL();
+
+  // The tick period (10 mS) is below the period of a frame, so the lock is lost
+  // after WATCHDOG_SCOR_FRAMES frame periods give or take a tick
+  if (now - last_scor > (FRAME_PERIOD_US * WATCHDOG_SCOR_FRAMES) / 1000 / portTICK_RATE_MS) {
+    status = R_LOCK_LOST_SCOR;
+  } else if (errors >= WATCHDOG_CRC_ERRORS) {
+    status = R_LOCK_LOST_CRC;
+  } else {
+    status = R_LOCKED;
+  }
+
+  if (status != watchdog_status) {
+    // Report how long the reader stayed in the previous status, so the time to
+    // recover the lock can be figured out from the events
+    notify_event(status, (now - watchdog_ticks) * portTICK_RATE_MS);
+
+    watchdog_status = status;
+    watchdog_ticks  = now;
+  }
+}
+
+static void print_event(const TReaderEvent* event) {
+  switch (event->type) {
+  case R_LOCKED:
+    printf("\033[2K\033[1mLock\033[22m: Acquired after %u mS\n", event->elapsed_ms);
+    break;
+
+  case R_LOCK_LOST_SCOR:
+    printf("\a\033[2K\033[1mLock\033[22m: Lost - No SCOR edges\n");
+    break;
+
+  case R_LOCK_LOST_CRC:
+    printf("\a\033[2K\033[1mLock\033[22m: Lost - Too many CRC errors\n");
+    break;
+  }
+}
+
 static void IRAM_ATTR read_lead_in() {
   bool     in_lead_in     = true;
   uint8_t  tno_first      = 0;
@@ -95,6 +218,8 @@ static void IRAM_ATTR read_lead_in() {
   uint8_t* toc_content    = NULL;
 
   while (in_lead_in) {
+    check_watchdog();
+
     if (read_index == BUFFER_SIZE) {
       read_index = 0;
     }
@@ -226,6 +351,8 @@ static void IRAM_ATTR read_program() {
   uint16_t jump_errors   = 0;
 
   while (in_program) {
+    check_watchdog();
+
     if (read_index == BUFFER_SIZE) {
       read_index = 0;
     }
@@ -319,6 +446,8 @@ static void IRAM_ATTR read_lead_out() {
   frc1.ctrl.en   = 1;
 
   while (in_lead_out) {
+    check_watchdog();
+
     if (read_index == BUFFER_SIZE) {
       read_index = 0;
     }
@@ -383,6 +512,16 @@ static void configure_gpio() {
   GPIO.pin[SCOR_PORT].int_type = GPIO_INTR_NEGEDGE;
 }
 
+static void set_sqck(uint8_t step) {
+  uint8_t n = sqck_steps[step];
+
+  SPI1.clock.clk_equ_sysclk  = 0;
+  SPI1.clock.clkdiv_pre      = 1;   // 80 / (1 + 1) = 40
+  SPI1.clock.clkcnt_n        = n;   // 40 / (N + 1)
+  SPI1.clock.clkcnt_h        = (n + 1) / 2 - 1;
+  SPI1.clock.clkcnt_l        = n;
+}
+
 static void configure_spi() {
   // Initialize the SPI struct leaving the reserved bits unchanged
   SPI1.cmd.val      &= 0x0003ffff;
@@ -429,11 +568,7 @@ static void configure_spi() {
   // Set clock frequency
   CLEAR_PERI_REG_MASK(PERIPHS_IO_MUX_CONF_U, SPI1_CLK_EQU_SYS_CLK);
 
-  SPI1.clock.clk_equ_sysclk  = 0;
-  SPI1.clock.clkdiv_pre      = 1;   // 80 / ( 1 + 1) = 40
-  SPI1.clock.clkcnt_n        = 39;  // 40 / (39 + 1) = 1 MHz
-  SPI1.clock.clkcnt_h        = 19;
-  SPI1.clock.clkcnt_l        = 39;
+  set_sqck(sqck_step);
 
   // Set MISO signal delay configuration
   SPI1.user.ck_out_edge      = 0;
@@ -451,12 +586,219 @@ static void configure() {
   portEXIT_CRITICAL();
 }
 
-void run_reader() {
+static bool load_sqck() {
+  nvs_handle handle;
+  uint8_t    step;
+  bool       found = false;
+
+  if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+    if (
+      nvs_get_u8(handle, NVS_KEY_SQCK, &step) == ESP_OK &&
+      step < sizeof(sqck_steps) / sizeof(uint8_t)
+    ) {
+      sqck_step = step;
+      found     = true;
+    }
+
+    nvs_close(handle);
+  }
+
+  return found;
+}
+
+static void store_sqck() {
+  nvs_handle handle;
+
+  if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+    nvs_set_u8(handle, NVS_KEY_SQCK, sqck_step);
+    nvs_commit(handle);
+    nvs_close (handle);
+  }
+}
+
+static bool IRAM_ATTR is_valid_bcd(uint8_t x) {
+  return (x & 0xf) <= 9 && (x >> 4) <= 9;
+}
+
+// Measures the pass rate, in per mille, at the given SQCK step. A frame passes
+// if it arrives with the CRC flag set and its ATIME decodes as a sane BCD value
+// that follows the previous frame
+//
+// @returns the pass rate; -1, if the frames stopped before the end of the measure.
+static int32_t IRAM_ATTR measure_sqck(uint8_t step) {
+  TickType_t start;
+  uint32_t first_scor;
+  uint32_t last_atime = 0;
+  uint32_t frames     = 0;
+  uint32_t skipped    = 0;
+  uint32_t passed     = 0;
+  uint32_t cycles;
+  uint32_t reads;
+
+  portENTER_CRITICAL();
+
+  set_sqck(step);
+
+  // Drop the frames read so far - The interrupt handler only writes to an empty
+  // buffer if both indices are 0
   read_index  = 0;
   write_index = 0;
+  read_count  = 0;
+  read_cycles = 0;
+  first_scor  = scor_count;
+
+  portEXIT_CRITICAL();
+
+  start = xTaskGetTickCount();
+
+  while ((frames = scor_count - first_scor) < SQCK_STEP_FRAMES) {
+    if (xTaskGetTickCount() - start > SQCK_STEP_TIMEOUT_MS / portTICK_RATE_MS) {
+      printf("\033[1mSQCK\033[22m: %5d KHz - Timed out after %d frames\n",
+        40000 / (sqck_steps[step] + 1),
+        frames
+      );
+
+      return -1;
+    }
+
+    if (read_index == BUFFER_SIZE) {
+      read_index = 0;
+    }
+
+    while (
+      (read_index + 3 < write_index) ||
+      (write_index < read_index && read_index < BUFFER_SIZE)
+    ) {
+      uint32_t q0     = buffer[read_index++];
+      uint32_t q1     = buffer[read_index++];
+      uint32_t q2     = buffer[read_index++] >> 16;
+      uint8_t  tno    = (REVERSE((q0 >> 20) & 0xf) << 4)
+                      | (REVERSE((q0 >> 16) & 0xf));
+      uint8_t  amin   = (REVERSE((q1 >>  4) & 0xf) << 4)
+                      | (REVERSE((q1 >>  0) & 0xf));
+      uint8_t  asec   = (REVERSE((q2 >> 12) & 0xf) << 4)
+                      | (REVERSE((q2 >>  8) & 0xf));
+      uint8_t  aframe = (REVERSE((q2 >>  4) & 0xf) << 4)
+                      | (REVERSE((q2 >>  0) & 0xf));
+      uint32_t atime;
+
+      // Only the program area carries the ATIME in these fields
+      if (tno == 0x00 || tno == 0xaa) {
+        skipped++;
+
+        continue;
+      }
+
+      if (!is_valid_bcd(amin) || !is_valid_bcd(asec) || !is_valid_bcd(aframe)) {
+        continue;
+      }
+
+      atime = (BCD2DEC(amin) * 60 + BCD2DEC(asec)) * 75 + BCD2DEC(aframe);
+
+      if (
+        BCD2DEC(asec) < 60 && BCD2DEC(aframe) < 75 &&
+        (last_atime == 0 || (atime > last_atime && atime - last_atime <= 75))
+      ) {
+        passed++;
+      }
+
+      last_atime = atime;
+    }
+  }
+
+  cycles = read_cycles;
+  reads  = read_count;
+
+  frames = frames > skipped ? frames - skipped : 0;
+
+  printf("\033[1mSQCK\033[22m: %5d KHz - "
+         "\033[1mRead\033[22m: %4d uS - "
+         "\033[1mPass\033[22m: %3d/%3d\n",
+    40000 / (sqck_steps[step] + 1),
+    reads == 0 ? 0 : CYCLES_TO_US(cycles / reads),
+    passed,
+    frames
+  );
+
+  return frames == 0 ? 0 : (passed * 1000) / frames;
+}
+
+// Steps the SQCK up while a disc is being played and keeps the fastest clock
+// that still reads the channel Q as reliably as the default clock does. If the
+// frames stop or none passes at the default clock, the default clock is kept
+// but not stored, so the calibration runs again on the next start-up
+static void IRAM_ATTR calibrate_sqck() {
+  int32_t baseline;
+  int32_t rate;
+
+  // Wait for the lock so the measurements are not affected by a disc that is
+  // still spinning up
+  while (watchdog_status != R_LOCKED) {
+    check_watchdog();
+  }
+
+  printf("Calibrating SQCK...\n");
+
+  baseline  = measure_sqck(SQCK_DEFAULT_STEP);
+  sqck_step = SQCK_DEFAULT_STEP;
+  rate      = baseline;
+
+  for (uint8_t i = 1; baseline > 0 && i < sizeof(sqck_steps) / sizeof(uint8_t); i++) {
+    if ((rate = measure_sqck(i)) < 0 || rate + SQCK_TOLERANCE_PM < baseline) {
+      break;
+    }
+
+    sqck_step = i;
+  }
+
+  if (baseline <= 0 || rate < 0) {
+    sqck_step = SQCK_DEFAULT_STEP;
+
+    set_sqck(sqck_step);
+
+    printf("SQCK calibration failed - The frames stopped or none passed\n\n");
+
+    return;
+  }
+
+  set_sqck(sqck_step);
+  store_sqck();
+
+  printf("SQCK set to %d KHz\n\n", 40000 / (sqck_steps[sqck_step] + 1));
+}
+
+int32_t rdr_add_listener(const rdr_listener_t listener_fn) {
+  if (n_listeners == MAX_LISTENERS) {
+    return -1;
+  }
+
+  listeners[n_listeners++] = listener_fn;
+
+  return 0;
+}
+
+void run_reader() {
+  bool is_calibrated;
+
+  read_index      = 0;
+  write_index     = 0;
+
+  scor_ticks      = xTaskGetTickCount();
+  crc_errors      = 0;
+  watchdog_ticks  = scor_ticks;
+
+  rdr_add_listener(print_event);
+
+  // The calibrated SQCK is kept in the storage system so the calibration only
+  // runs the very first time
+  is_calibrated   = nvs_flash_init() == ESP_OK && load_sqck();
 
   configure();
 
+  if (!is_calibrated) {
+    calibrate_sqck();
+  }
+
   while (true) {
     read_lead_in ();
     read_program ();
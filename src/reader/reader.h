@@ -1,5 +1,32 @@
 #pragma once
 
+#include <stdint.h>
+
+enum kReaderEvent {
+  R_LOCKED = 0,     // Subcode frames are being received and pass the CRC check
+  R_LOCK_LOST_SCOR, // No SCOR edges for a few frame periods
+  R_LOCK_LOST_CRC,  // Too many consecutive frames failing the CRC check
+};
+
+typedef struct {
+  uint8_t     type;       // One of kReaderEvent
+  uint32_t    elapsed_ms; // Time spent in the previous status
+} TReaderEvent;
+
+// Signature of the callback function to call on an event
+typedef void (*rdr_listener_t)(const TReaderEvent*);
+
+/**
+ * Registers a new listener.
+ *
+ * The listener is notified by the watchdog every time the lock on the channel Q
+ * stream is lost or acquired. Listeners are called from the task running the
+ * reader so they must return quickly.
+ *
+ * @returns 0, on success; -1, if no more listeners can be registered.
+ */
+int32_t rdr_add_listener(const rdr_listener_t);
+
 /**
  * Runs the reader.
  *
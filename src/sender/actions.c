@@ -1,6 +1,11 @@
 #include "actions.h"
 #include "controller.h"
 
+// Scans the disc surface with the default spacing and dwell time
+static int32_t scan_disc() {
+  return ctl_scan(0, 0);
+}
+
 const TAction actions[] = {
   {
     '0',
@@ -37,4 +42,24 @@ const TAction actions[] = {
     "Tune tracking",
     ctl_tune_tracking
   },
+  {
+    '7',
+    "Run user script",
+    ctl_run_user_script
+  },
+  {
+    '8',
+    "Calibrate tracking balance and gain",
+    ctl_calibrate_tracking
+  },
+  {
+    '9',
+    "Next track",
+    ctl_seek_next_track
+  },
+  {
+    'a',
+    "Scan the disc surface",
+    scan_disc
+  },
 };
@@ -1,6 +1,8 @@
 #pragma once
 
-typedef void (*action_fn)();
+#include <stdint.h>
+
+typedef int32_t (*action_fn)();
 typedef struct {
   const char      id;
   const char*     description;
@@ -8,4 +10,4 @@ typedef struct {
 } TAction;
 
 // Contains all the actions implemented in the controller
-const TAction actions[7];
+const TAction actions[11];
@@ -0,0 +1,178 @@
+#include "bus.h"
+#include "common.h"
+
+// ESP8266
+#include "esp8266/spi_struct.h"
+
+// ESP SDK
+#include "esp_attr.h"
+#include "driver/soc.h"
+
+// FreeRTOS
+#include "FreeRTOS.h"
+
+// SQCK for the channel Q - 40 MHz / (N + 1) = 1 MHz, which is the default clock
+// of the reader
+#define SQCK_CLKCNT_N       39
+
+// Value of the owner while the bus is free
+#define NO_OWNER            B_COUNT
+
+// The setup of the SPI that differs between the clients
+typedef struct {
+  uint32_t      clock;
+  uint32_t      user;
+} TConfig;
+
+typedef struct {
+  bus_handler_t handler;
+  uint32_t      deadline;   // Maximum wait in CPU cycles - 0 if there is none
+  bool          is_pending; // Whether a request is waiting for the bus
+  uint32_t      since;      // CPU cycle count at the request
+} TClient;
+
+static DRAM_ATTR TConfig           configs[B_COUNT];
+static DRAM_ATTR TClient           clients[B_COUNT];
+static DRAM_ATTR volatile uint8_t  owner   = NO_OWNER;
+static DRAM_ATTR uint8_t           current = B_MICOM; // The client whose configuration is set
+
+static DRAM_ATTR volatile TBusStats stats;
+
+// Sets the configuration of a client, unless it is set already
+static void IRAM_ATTR switch_to(uint8_t client) {
+  uint32_t start;
+  uint32_t cycles;
+
+  if (client == current) {
+    return;
+  }
+
+  start           = soc_get_ccount();
+
+  SPI1.clock.val  = configs[client].clock;
+  SPI1.user.val   = configs[client].user;
+
+  current         = client;
+  cycles          = soc_get_ccount() - start;
+
+  stats.n_switches++;
+  stats.switch_cycles += cycles;
+
+  if (cycles > stats.max_switch_cycles) {
+    stats.max_switch_cycles = cycles;
+  }
+}
+
+static bool IRAM_ATTR grant(uint8_t client) {
+  owner = client;
+
+  switch_to(client);
+
+  stats.n_grants[client]++;
+
+  return clients[client].handler();
+}
+
+void bus_start() {
+  portENTER_CRITICAL();
+
+  // The MICOM interface is taken as set up
+  configs[B_MICOM].clock    = SPI1.clock.val;
+  configs[B_MICOM].user     = SPI1.user.val;
+
+  // The channel Q samples on the other clock edge, has no command phase and only
+  // reads
+  SPI1.user.ck_out_edge     = 0; // CPHA
+  SPI1.user.usr_command     = 0;
+  SPI1.user.usr_miso        = 1;
+
+  SPI1.clock.clkcnt_n       = SQCK_CLKCNT_N;
+  SPI1.clock.clkcnt_h       = (SQCK_CLKCNT_N + 1) / 2 - 1;
+  SPI1.clock.clkcnt_l       = SQCK_CLKCNT_N;
+
+  configs[B_SUBQ].clock     = SPI1.clock.val;
+  configs[B_SUBQ].user      = SPI1.user.val;
+
+  // Back to the MICOM interface
+  SPI1.clock.val            = configs[B_MICOM].clock;
+  SPI1.user.val             = configs[B_MICOM].user;
+
+  current                   = B_MICOM;
+
+  portEXIT_CRITICAL();
+}
+
+void bus_set_handler(uint8_t client, bus_handler_t handler, uint32_t deadline_us) {
+  portENTER_CRITICAL();
+
+  clients[client].handler    = handler;
+  clients[client].deadline   = deadline_us * CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ;
+  clients[client].is_pending = false;
+
+  portEXIT_CRITICAL();
+}
+
+bool IRAM_ATTR bus_request(uint8_t client) {
+  if (owner != NO_OWNER) {
+    clients[client].is_pending = true;
+    clients[client].since      = soc_get_ccount();
+
+    stats.n_deferred++;
+
+    return false;
+  }
+
+  return grant(client);
+}
+
+bool IRAM_ATTR bus_release(uint8_t client) {
+  if (owner != client) {
+    return false;
+  }
+
+  owner = NO_OWNER;
+
+  for (uint8_t i = 0; i < B_COUNT; i++) {
+    TClient* c = &clients[i];
+    uint32_t waited;
+
+    if (!c->is_pending) {
+      continue;
+    }
+
+    c->is_pending = false;
+    waited        = soc_get_ccount() - c->since;
+
+    if (c->deadline != 0 && waited > c->deadline) {
+      stats.n_missed++;
+
+      continue;
+    }
+
+    if (CYCLES_TO_US(waited) > stats.max_wait_us) {
+      stats.max_wait_us = CYCLES_TO_US(waited);
+    }
+
+    // The requests left are granted once this one releases the bus
+    return grant(i);
+  }
+
+  return false;
+}
+
+void bus_get_stats(TBusStats* s) {
+  portENTER_CRITICAL();
+
+  for (size_t i = 0; i < B_COUNT; i++) {
+    s->n_grants[i]     = stats.n_grants[i];
+  }
+
+  s->n_deferred        = stats.n_deferred;
+  s->n_missed          = stats.n_missed;
+  s->max_wait_us       = stats.max_wait_us;
+  s->n_switches        = stats.n_switches;
+  s->switch_cycles     = stats.switch_cycles;
+  s->max_switch_cycles = stats.max_switch_cycles;
+
+  portEXIT_CRITICAL();
+}
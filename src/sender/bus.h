@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Clients of the HSPI bus, ordered by priority - The channel Q and the MICOM
+// interface share the clock line and the SPI but need a different setup
+enum kBusClient {
+  B_SUBQ = 0, // Channel Q frames read on MISO, clocked by SQCK
+  B_MICOM,    // MICOM commands written on MOSI and latched by XLT
+  B_COUNT
+};
+
+// Signature of the function to call once a client is granted the bus. It is
+// called with the configuration of the client set, either from the interrupt
+// handler requesting the bus or from the one releasing it, so it must be placed
+// in IRAM and return quickly. The returned value tells whether a task has been
+// woken up
+typedef bool (*bus_handler_t)();
+
+// Counters of the arbiter
+typedef struct {
+  uint32_t    n_grants[B_COUNT];  // Requests granted per client
+  uint32_t    n_deferred;         // Requests kept waiting for the bus
+  uint32_t    n_missed;           // Requests dropped as their deadline expired
+  uint32_t    max_wait_us;        // Longest wait of a request granted
+  uint32_t    n_switches;         // Switches of the configuration
+  uint32_t    switch_cycles;      // CPU cycles spent switching the configuration
+  uint32_t    max_switch_cycles;  // Longest switch of the configuration
+} TBusStats;
+
+/**
+ * Starts arbitrating the bus.
+ *
+ * The configuration of the MICOM interface is taken from the SPI, which must
+ * be set up already, and the one of the channel Q is derived from it. This API
+ * must be called before any of the interrupts using the bus is enabled.
+ */
+void bus_start();
+
+/**
+ * Sets the function to call once a client is granted the bus.
+ *
+ * If the deadline is not 0, a request waiting for the bus longer than it is
+ * dropped rather than granted.
+ */
+void bus_set_handler(uint8_t client, bus_handler_t handler, uint32_t deadline_us);
+
+/**
+ * Requests the bus for a client.
+ *
+ * If the bus is free the configuration of the client is set and its handler is
+ * called at once; otherwise, the request is kept until the bus is released.
+ * This API must be called from an interrupt handler or a critical section.
+ *
+ * @returns true, if a task has been woken up.
+ */
+bool bus_request(uint8_t client);
+
+/**
+ * Releases the bus held by a client.
+ *
+ * The requests kept are granted by priority before this API returns. A client
+ * holds the bus from the call of its handler until it releases it, so a
+ * handler completing its transfer at once must release the bus itself.
+ *
+ * @returns true, if a task has been woken up.
+ */
+bool bus_release(uint8_t client);
+
+/**
+ * Gets the counters of the arbiter since the start.
+ */
+void bus_get_stats(TBusStats* stats);
@@ -6,14 +6,24 @@
 //
 // - GPIO1 and GPIO3 are externally connected to the UART interface of CH340C
 // - GPIO16 is internally connected to the RTC module
+// - GPIO10 is free as the flash memory is accessed in DIO mode
+// - GPIO14 clocks both the MICOM interface (CLK) and the channel Q (SQCK)
+// - GPIO0 and GPIO15 are boot strapping pins - XLT idles high and SCOR is low
+//   while the DSP IC is in RESET state, so both are at the boot levels
+// - GPIO9 is only free if the flash memory does not use /HOLD in DIO mode, so
+//   TRCNT is only read if CONFIG_SENDER_TRCNT is enabled
 
 #define XRST_PORT       GPIO_NUM_16 // D0 (RTC)
 #define LED_PORT        GPIO_NUM_2  // D4
 #define CLK_PORT        GPIO_NUM_14 // D5
-#define XLT_PORT        GPIO_NUM_12 // D6
+#define XLT_PORT        GPIO_NUM_0  // D3
 #define DATA_PORT       GPIO_NUM_13 // D7
 #define FOK_PORT        GPIO_NUM_5  // D1
 #define SENS_PORT       GPIO_NUM_4  // D2
+#define GFS_PORT        GPIO_NUM_10 // SD3
+#define SUBQ_PORT       GPIO_NUM_12 // D6
+#define SCOR_PORT       GPIO_NUM_15 // D8
+#define TRCNT_PORT      GPIO_NUM_9  // SD2
 
 // Macros for setting the level of the GPIO ports - I found it is way faster to
 // use those rather than writing to the GPIO struct
@@ -37,3 +47,6 @@
 // Macro for converting a value given in uS to ticks for the FRC Timer
 // Clock divider must be set to TIMER_CLKDIV_16
 #define US_TO_TICKS(t)  ((80000000 >> frc1.ctrl.div) / 1000000) * t
+
+// Macro for converting a value given in CPU cycles to uS
+#define CYCLES_TO_US(c) ((c) / CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ)
@@ -5,3 +5,6 @@
 
 COMPONENT_EMBED_TXTFILES := \
   resources/index.html
+
+# The MICOM command table is shared with the sniffer
+COMPONENT_PRIV_INCLUDEDIRS := ../micom
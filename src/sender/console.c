@@ -0,0 +1,216 @@
+#include "console.h"
+
+// ESP8266
+#include "rom/ets_sys.h"
+#include "esp8266/uart_struct.h"
+
+// ESP SDK
+#include "esp_attr.h"
+
+// FreeRTOS
+#include "FreeRTOS.h"
+#include "freertos/task.h"
+
+// C
+#include <stdio.h>
+
+// Size of the ring of received bytes - It must be a power of 2
+#define RING_SIZE           1024
+
+// Fill levels of the ring for pausing (XOFF) and resuming (XON) the sender
+#define PAUSE_LEVEL         (RING_SIZE * 3 / 4)
+#define RESUME_LEVEL        (RING_SIZE / 4)
+
+// Bytes in the RX FIFO for raising the interrupt - Fewer bytes are signaled
+// once the line has been idle for the time of a couple of bytes
+#define RX_FULL_THRESHOLD   64
+#define RX_IDLE_BYTES       2
+
+// Size of the TX FIFO
+#define TX_FIFO_SIZE        128
+
+#define XON                 0x11
+#define XOFF                0x13
+#define ESC                 0x1b
+#define CTRL_U              0x15
+
+static DRAM_ATTR uint8_t           ring[RING_SIZE];
+static DRAM_ATTR volatile uint32_t write_count = 0; // Bytes written to the ring
+static DRAM_ATTR volatile uint32_t read_count  = 0; // Bytes read from the ring
+static DRAM_ATTR volatile uint32_t n_overruns  = 0;
+static DRAM_ATTR volatile bool     is_paused   = false;
+static DRAM_ATTR TaskHandle_t      reader      = NULL;
+
+static void IRAM_ATTR uart_isr_cb() {
+  BaseType_t woken  = pdFALSE;
+  uint32_t   status = uart0.int_st.val;
+
+  while (uart0.status.rxfifo_cnt > 0) {
+    uint8_t c = uart0.fifo.rw_byte;
+
+    if (write_count - read_count < RING_SIZE) {
+      ring[write_count % RING_SIZE] = c;
+
+      write_count++;
+    } else {
+      n_overruns++;
+    }
+  }
+
+  // Pause the sender while there is room for what it sends until it stops.
+  // The XOFF is retried on the next interrupt if the TX FIFO is full
+  if (
+    !is_paused                                &&
+    write_count - read_count >= PAUSE_LEVEL   &&
+    uart0.status.txfifo_cnt < TX_FIFO_SIZE - 1
+  ) {
+    uart0.fifo.rw_byte = XOFF;
+
+    is_paused = true;
+  }
+
+  uart0.int_clr.val = status;
+
+  if (reader != NULL) {
+    vTaskNotifyGiveFromISR(reader, &woken);
+  }
+
+  if (woken == pdTRUE) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+// Resumes the sender once the ring has been drained enough
+static void resume() {
+  portENTER_CRITICAL();
+
+  if (is_paused && write_count - read_count <= RESUME_LEVEL) {
+    while (uart0.status.txfifo_cnt >= TX_FIFO_SIZE - 1);
+
+    uart0.fifo.rw_byte = XON;
+
+    is_paused = false;
+  }
+
+  portEXIT_CRITICAL();
+}
+
+void con_start() {
+  portENTER_CRITICAL();
+
+  uart0.conf1.rxfifo_full_thrhd = RX_FULL_THRESHOLD;
+  uart0.conf1.rx_tout_thrhd     = RX_IDLE_BYTES;
+  uart0.conf1.rx_tout_en        = 1;
+
+  uart0.int_clr.val             = 0xFFFF;
+  uart0.int_ena.val             = 0;
+  uart0.int_ena.rxfifo_full     = 1;
+  uart0.int_ena.rxfifo_tout     = 1;
+  uart0.int_ena.rxfifo_ovf      = 1;
+
+  _xt_isr_attach(ETS_UART_INUM, uart_isr_cb, NULL);
+  _xt_isr_unmask(1 << ETS_UART_INUM);
+
+  portEXIT_CRITICAL();
+}
+
+int32_t con_read(uint32_t timeout_ms) {
+  TickType_t start = xTaskGetTickCount();
+  TickType_t ticks = timeout_ms / portTICK_RATE_MS;
+  TickType_t elapsed;
+  uint8_t    c;
+
+  reader = xTaskGetCurrentTaskHandle();
+
+  // A byte received after the check below leaves the notification pending so
+  // it is not missed
+  while (write_count == read_count) {
+    if ((elapsed = xTaskGetTickCount() - start) >= ticks) {
+      return CON_NONE;
+    }
+
+    ulTaskNotifyTake(pdTRUE, ticks - elapsed);
+  }
+
+  c = ring[read_count % RING_SIZE];
+
+  read_count++;
+
+  if (is_paused) {
+    resume();
+  }
+
+  return c;
+}
+
+int32_t con_read_line(char* line, size_t size, bool is_echoed) {
+  size_t n = 0;
+
+  while (true) {
+    int32_t c = con_read(portMAX_DELAY);
+
+    switch (c) {
+    case CON_NONE:
+      continue;
+
+    case '\r':
+    case '\n':
+      line[n] = '\0';
+
+      if (is_echoed) {
+        printf("\n");
+      }
+
+      return n;
+
+    case ESC:
+      line[0] = '\0';
+
+      if (is_echoed) {
+        printf("\n");
+      }
+
+      return CON_CANCELLED;
+
+    case '\b':
+    case 0x7f:
+      if (n > 0) {
+        n--;
+
+        if (is_echoed) {
+          printf("\b \b");
+        }
+      }
+      break;
+
+    case CTRL_U:
+      if (is_echoed) {
+        for (; n > 0; n--) {
+          printf("\b \b");
+        }
+      }
+
+      n = 0;
+      break;
+
+    default:
+      // Control characters are ignored and so are the characters not fitting
+      // in the line
+      if (c >= ' ' && n < size - 1) {
+        line[n++] = c;
+
+        if (is_echoed) {
+          printf("%c", (char) c);
+        }
+      }
+    }
+
+    if (is_echoed) {
+      fflush(stdout);
+    }
+  }
+}
+
+uint32_t con_get_overruns() {
+  return n_overruns;
+}
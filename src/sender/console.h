@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Result codes of the APIs reading the console
+enum kConsoleResult {
+  CON_NONE      = -1, // There was no input before the timeout expired
+  CON_CANCELLED = -2, // The line was cancelled with ESC
+};
+
+/**
+ * Starts receiving the console input.
+ *
+ * The bytes received on UART0 are moved to a ring by the RX interrupt handler,
+ * which wakes up the task reading the console. The sender is paced with
+ * XON/XOFF while the ring is nearly full, so input can be streamed at full
+ * baud rate by a terminal honoring software flow control.
+ */
+void con_start();
+
+/**
+ * Reads the next byte of the console input.
+ *
+ * If there is no input the calling task is blocked until a byte is received or
+ * the timeout expires, whichever occurs first. Only one task may read the
+ * console.
+ *
+ * @returns the byte read, on success; CON_NONE, if the timeout expired.
+ */
+int32_t con_read(uint32_t timeout_ms);
+
+/**
+ * Reads a line of the console input with basic line editing.
+ *
+ * BS and DEL erase the last character, CTRL+U erases the whole line and ESC
+ * cancels it. The line ends with CR or LF, which is not stored, and is always
+ * terminated with a null character. If echo is enabled the line is echoed as
+ * it is typed; otherwise, it is read silently, e.g. when streamed.
+ *
+ * @returns the length of the line, on success; CON_CANCELLED, if the line was
+ * cancelled.
+ */
+int32_t con_read_line(char* line, size_t size, bool is_echoed);
+
+/**
+ * Returns the number of bytes lost as the ring was full since the start.
+ */
+uint32_t con_get_overruns();
@@ -1,31 +1,43 @@
 #include "controller.h"
+#include "bus.h"
 #include "common.h"
+#include "frc.h"
+#include "latency.h"
+#include "micom.h"
+#include "profile.h"
+#include "replay.h"
+#include "sampler.h"
+#include "script.h"
+#include "subq.h"
+#include "trcnt.h"
 
 // ESP8266
 #include "rom/ets_sys.h"
+#include "esp8266/gpio_struct.h"
 #include "esp8266/spi_struct.h"
-#include "esp8266/timer_struct.h"
 #include "driver/gpio.h"
 
 // ESP SDK
 #include "esp_attr.h"
+#include "esp_log.h"
+#include "driver/soc.h"
 
 // FreeRTOS
 #include "FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
-// Reads the voltage at ADC pin
-extern uint16_t test_tout();
+// C
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
-// Threshold values for ADC
+#define LED_ON_MS              40 // The time the LED must be ON
+#define LED_OFF_MS            800 // The time the LED must be OFF
 
-#define POWER_ON_STATUS_MIN 200
-#define POWER_ON_STATUS_MAX 800
-#define PICKUP_LIMIT_SW_MIN 350
-#define PICKUP_LIMIT_SW_MAX 500
-
-#define LED_ON_US            40000 // The time the LED must be ON
-#define LED_OFF_US          800000 // The time the LED must be OFF
+// Period for checking whether the power has been lost while it is powered
+#define POWER_CHECK_MS        500
 
 // A few macros/helpers for dealing with the status
 
@@ -35,17 +47,101 @@ extern uint16_t test_tout();
 #define IS_POWERED(s)       ((s & STATUS_MASK) != S_WAIT_FOR_POWER)
 #define STATUS_TEXT(s)      controller_status_text[s & STATUS_MASK]
 
-// A macro for creating a task for running an action
-#define RUN_TASK(t)         xTaskCreate(run_action, "ctlAction", 1024, t, 1, NULL)
+// Maximum number of actions waiting to be run
+#define ACTION_QUEUE_LENGTH 4
+
+// Size of the event ring - Subscribers falling behind by more events than this
+// miss some of them
+#define EVENT_RING_SIZE     32
 
-// Maximum number of registered listeners allowed
-#define MAX_LISTENERS       2
+// Maximum number of subscribers allowed
+#define MAX_SUBSCRIBERS     8
 
 // The timeout for operations
 #define OPERATION_TIMEOUT_S 5
 
-// Delay between MICOM commands
-#define MICOM_CMD_DELAY_MS  50
+// Size of the queue of MICOM commands waiting to be transmitted
+#define TX_QUEUE_SIZE       64
+
+// Size of the queue of MICOM commands of a replay waiting to be sent
+#define REPLAY_QUEUE_LENGTH 64
+
+// Longest time without new commands before a replay is given up
+#define REPLAY_TIMEOUT_MS   5000
+
+// Longest time kept between two commands of a replay, once scaled by its speed
+// - The CPU cycle count
+// wraps around every 26 S at 160 MHz
+#define REPLAY_MAX_DELAY_US 10000000
+
+// Length of the command marking the end of a replay
+#define REPLAY_END_BITS     0xFF
+
+// Interrupt status of the SPI modules
+#ifndef DPORT_SPI_INT_STATUS_REG
+#define DPORT_SPI_INT_STATUS_REG  0x3ff00020
+#endif
+#define DPORT_SPI_INT_STATUS_SPI1 BIT(7)
+
+// Tracking calibration - The balance and the gain are probed by sampling SENS
+// while the tracking error crosses the window comparator. The balance is right
+// when SENS is high half of the time and the gain when it is high at least the
+// target ratio of the time
+#define TRACKING_SETTLE_MS      20  // Time for the tracking error to settle after a new value
+#define TRACKING_SAMPLES        200 // Samples of SENS per probe
+#define TRACKING_SAMPLE_US      50  // Time between samples
+#define TRACKING_BALANCE_TARGET 50  // Ratio (%) of samples high for the balance
+#define TRACKING_GAIN_TARGET    50  // Ratio (%) of samples high for the gain
+#define TRACKING_TOLERANCE      5   // Maximum error (%) accepted for stopping early
+#define TRACKING_MAX_VALUE      0x1F
+
+// Seek - The position of the optical pickup is estimated from the absolute time
+// with a CLV model of the disc, so the distance to the target is given in tracks
+#define SEEK_MAX_ITERATIONS     8
+#define SEEK_TOLERANCE_FRAMES   150   // A target up to 2 S ahead is reached by playing
+#define SEEK_FINE_MAX_TRACKS    30    // Longest move done with a single 2N track jump
+#define SEEK_KICK_TRACKS_PER_MS 20    // Initial estimate of the tracks crossed per mS of kick
+#define SEEK_LOCK_TIMEOUT_MS    1000  // Timeout for the frame lock after a move
+#define SEEK_Q_TIMEOUT_MS       500   // Timeout for reading a frame after a move
+#define SEEK_TOC_TIMEOUT_MS     5000  // Timeout for reading the TOC from the lead-in
+#define SEEK_LEAD_IN_FRAMES     (-SUBQ_FRAMES(1, 0, 0)) // Position assumed in the lead-in
+#define SEEK_NEXT_TRACK         0xFF  // Target track of ctl_seek_next_track
+
+// Play supervisor - While a disc is being played the lines and the channel Q
+// are watched, and a loss lasting long enough is recovered
+#define SUPERVISOR_CHECK_MS     100   // Period for checking the status when not playing
+#define SUPERVISOR_LOSS_MS      200   // Time the loss of a line must last before recovering it
+#define SUPERVISOR_STUCK_FRAMES 75    // Frames out of sequence before the pickup is considered stuck
+#define SUPERVISOR_MAX_GAP      75    // Largest gap between frames in sequence (frames dropped)
+#define RECOVERY_VERIFY_MS      1000  // Time for the playback to be restored after a step
+#define RECOVERY_FOCUS_MS       500   // Timeout of each attempt to find focus
+#define RECOVERY_FOCUS_ATTEMPTS 3
+
+// Maximum number of consecutive points of a surface scan not reached before
+// the scan is aborted
+#define SCAN_MAX_FAILURES       3
+
+// CLV model - Radius where the program area starts, scanning velocity and track
+// pitch as given by the Red Book
+#define CLV_R0_UM               25000.0f
+#define CLV_VELOCITY_UM_S       1300000.0f
+#define CLV_PITCH_UM            1.6f
+
+// Macros for printing an absolute time given in frames as MM:SS.FF
+#define MSF_FORMAT              "%02d:%02d.%02d"
+#define MSF(t)                  (t) / 4500, ((t) / 75) % 60, (t) % 75
+
+// Timeout waiting on SENS for MICOM commands completing asynchronously
+#define MICOM_SENS_TIMEOUT_MS 1000
+
+// Time a SENS command is given to pull SENS low - If SENS is high after it, the
+// command is taken as completed even if no rising edge has been seen
+#define MICOM_SENS_SETTLE_MS   100
+
+// Waits for the given time in mS and returns from the running action if it is
+// cancelled meanwhile - Only for the actions run by run_actions_task, as any
+// other task would return from its task function, so they use vTaskDelay
+#define WAIT(ms)            if (wait_ms(ms)) { return; }
 
 // Delays for X * 25 ns (X < 2048)
 #define DELAY(X) \
@@ -59,27 +155,60 @@ extern uint16_t test_tout();
     : "a2" \
   )
 
-enum kControllerStatus {
-  S_WAIT_FOR_POWER = 0,
-  S_IDLE,
-  S_ERROR_TIMED_OUT,
-  S_UNEXPECTED_ERROR,
-  S_NO_DISC,
-  S_PLAYING,
-  S_PAUSED,
-  S_RESET_IN_PROGRESS,
-  S_PICKUP_TO_INITIAL_POSITION,
-  S_PICKUP_MOVE_BACKWARDS,
-  S_TESTING_TRACKING_COIL,
-  S_TESTING_SLED_MOTOR,
-  S_TESTING_FOCUS_COIL,
-  S_TESTING_SPINDLE_MOTOR,
-  S_LOOKING_FOR_DISC,
-  S_RUNNING_MICOM_COMMANDS,
+enum kControllerAction {
+  A_RESET = 0,
+  A_MOVE_PICKUP_TO_INITIAL_POSITION,
+  A_MOVE_PICKUP_TO_INITIAL_POSITION_THEN_MOVE_IT_BACK,
+  A_RUN_TEST_COILS_AND_MOTORS,
+  A_PLAY,
+  A_STOP,
+  A_TUNE_TRACKING,
+  A_RUN_MICOM_COMMANDS,
+  A_RUN_USER_SCRIPT,
+  A_CALIBRATE_TRACKING,
+  A_SEEK,
+  A_RECOVER,
+  A_SCAN,
+  A_REPLAY,
+};
+
+// Losses of the playback noticed by the supervisor
+enum kPlayLoss {
+  L_FOCUS = 0,
+  L_LOCK,
+  L_NO_FRAMES,
+  L_STUCK,
+  L_JUMP,
+  L_NONE
 };
 
 typedef int32_t ctl_status;
 
+typedef struct {
+  uint8_t              action;      // One of kControllerAction
+  uint32_t             cycles;      // CPU cycle count when the action was queued
+  size_t               n;           // Number of MICOM commands - A_RUN_MICOM_COMMANDS only
+  uint16_t*            commands;    // MICOM commands           - A_RUN_MICOM_COMMANDS only
+  ctl_micom_listener_t listener_fn; // Listener for the results - A_RUN_MICOM_COMMANDS only
+  TSeekTarget          target;      // Target of the seek       - A_SEEK and A_RECOVER only
+  uint8_t              step;        // First recovery step      - A_RECOVER only
+  TickType_t           since;       // Tick count at the loss   - A_RECOVER only
+  uint16_t             spacing_s;   // Spacing of the points    - A_SCAN only
+  uint16_t             dwell_ms;    // Dwell time at each point - A_SCAN only
+  uint16_t             speed_pct;   // Speed of the replay      - A_REPLAY only
+  char*                text;        // Captured session         - A_REPLAY only; NULL if written
+} TRequest;
+
+// State of a replay kept between its commands
+typedef struct {
+  uint16_t             speed_pct;
+  uint32_t             last;        // CPU cycle count when the last command was sent
+  uint32_t             n;           // Commands sent
+  uint32_t             max_late;    // Longest delay of a command past its time
+} TReplayState;
+
+static const char*    module_id                = "controller";
+
 static ctl_status     controller_status        = S_WAIT_FOR_POWER;
 static const char*    controller_status_text[] = {
   "Waiting for Controller PCB to be powered up...",
@@ -98,22 +227,262 @@ static const char*    controller_status_text[] = {
   "Testing spindle motor...",
   "Looking for disc...",
   "Running MICOM commands...",
+  "Running script...",
+  "Calibrating tracking balance and gain...",
+  "Seeking...",
+  "Recovering the playback...",
+  "Scanning the disc surface...",
+  "Replaying a captured session...",
+};
+
+// Names of the losses of the playback - See kPlayLoss
+static const char*    loss_text[] = {
+  "Focus lost",
+  "Frame lock lost",
+  "No channel Q frames",
+  "Stuck",
+  "Jump",
+};
+
+// Names of the recovery steps - See kRecoveryStep
+static const char*    recovery_text[] = {
+  "tracking",
+  "focus",
+  "seek",
+};
+
+// Names of the phases of the timing breakdown - See kScriptPhase
+static const char*    phase_text[] = {
+  "Reset",
+  "Focus bias",
+  "Offset cancel",
+  "Focus search",
+  "Servos",
+  "Frame lock",
 };
-static size_t         n_listeners              = 0;
-static ctl_listener_t listeners[MAX_LISTENERS];
 
-static size_t         micom_task_n             = 0;
-static uint16_t*      micom_task_commands      = NULL;
+typedef struct {
+  uint32_t     cursor;  // Sequence number of the next event to read
+  TaskHandle_t task;    // The task reading the events - Notified on new events
+} TSubscriber;
+
+// The event ring - The events are written in critical sections so a reader only
+// needs to check the sequence number once it has copied an event
+static TEvent            event_ring[EVENT_RING_SIZE];
+static volatile uint32_t event_sequence        = 0; // Sequence number of the next event
+static volatile size_t   n_subscribers         = 0;
+static TSubscriber       subscribers[MAX_SUBSCRIBERS];
+
+static QueueHandle_t     action_queue          = NULL;
+static TaskHandle_t      action_task           = NULL;
+static SemaphoreHandle_t sens_semaphore        = NULL;
+
+// The commands of the replay being run - Written by the producer of the session
+// while the replay is open
+static QueueHandle_t     replay_queue          = NULL;
+static volatile bool     is_replay_open        = false;
+
+// Indicates if the running action must be cancelled as soon as possible
+static volatile bool     cancel_requested      = false;
+
+// Indicates if an action is being run - An action may go through a status that
+// is not busy, e.g. the end of the TUNE TRACKING script when calibrating, and it
+// must still be cancellable meanwhile
+static volatile bool     is_action_running     = false;
+
+// The CPU cycle count when the running action was queued. It is used for
+// measuring the latency until the first MICOM command is sent
+static uint32_t          request_cycles        = 0;
+
+// The script being run
+static uint32_t          script_code[SCRIPT_MAX_LENGTH];
+
+// The timer blinking the LED while the controller is not powered
+static int32_t           led_timer             = -1;
+static DRAM_ATTR bool    led_on                = false;
+
+// The result of the last tracking calibration
+static TTrackingCalibration tracking_calibration;
+
+// The subscriber to the channel Q frames and the result of the last seek
+static int32_t           q_subscriber          = -1;
+static TSeekResult       seek_result;
+
+// The table of contents used by the seeks and the scans - It does not fit in
+// the stack of the action task
+static TToc              seek_toc;
+
+// Time taken by the frame lock after the last move of the optical pickup
+static uint32_t          lock_ms               = 0;
+
+// The metrics of the recoveries of the playback
+static TRecoveryStats    recovery_stats;
+static DRAM_ATTR TTimingStats timing_stats; // Updated by the SPI interrupt handler too
+
+// The map of the last surface scan
+static TScanInfo         scan_info;
+static TScanPoint        scan_points[SCAN_MAX_POINTS];
+
+// Number of edges of FOK while its interrupt is enabled
+static DRAM_ATTR volatile uint32_t fok_edges = 0;
+
+// The queue of MICOM commands waiting to be transmitted - The commands are
+// written by the tasks and read by the SPI interrupt handler, which triggers the
+// latch signal and starts the transmission of the next command. Each entry holds
+// the command in the lower 16 bits and its length in bits above them
+static DRAM_ATTR uint32_t         tx_queue[TX_QUEUE_SIZE];
+static DRAM_ATTR volatile size_t  tx_read_idx   = 0;
+static DRAM_ATTR volatile size_t  tx_write_idx  = 0;
+static DRAM_ATTR volatile bool    tx_busy       = false;
+static DRAM_ATTR volatile uint32_t tx_count     = 0;  // Commands transmitted in the current burst
+static DRAM_ATTR volatile uint32_t tx_cycles    = 0;  // CPU cycle count at the start of the current burst
+static SemaphoreHandle_t          tx_semaphore  = NULL;
+
+// Timestamps for profiling the completion of the commands - The command latched
+// last, the CPU cycle count when it was latched and when each line went high
+static DRAM_ATTR volatile uint16_t tx_command    = 0;  // Command being transmitted
+static DRAM_ATTR volatile uint16_t latch_command = 0;
+static DRAM_ATTR volatile uint32_t latch_cycles  = 0;
+static DRAM_ATTR volatile uint32_t rise_cycles[LAT_COUNT];
+
+static void IRAM_ATTR start_transmission(uint32_t entry) {
+  uint16_t command = entry & 0xFFFF;
+  uint8_t  bits    = entry >> 16;
+
+  tx_command                    = command;
+
+  // Enable the command phase
+  SPI1.user.usr_command         = 1;
+
+  // Set the command and the length
+  SPI1.user2.usr_command_value  = command;
+  SPI1.user2.usr_command_bitlen = bits - 1;
+
+  // Start the operation
+  SPI1.cmd.usr                  = 1;
+}
+
+// Transmits the next command of the queue once the bus is granted
+static bool IRAM_ATTR transmit_next() {
+  start_transmission(tx_queue[tx_read_idx]);
+
+  tx_read_idx = (tx_read_idx + 1) % TX_QUEUE_SIZE;
+
+  return false;
+}
+
+static void IRAM_ATTR spi_isr_cb() {
+  BaseType_t woken = pdFALSE;
+
+  if ((READ_PERI_REG(DPORT_SPI_INT_STATUS_REG) & DPORT_SPI_INT_STATUS_SPI1) == 0) {
+    return;
+  }
+
+  // Clear the interrupt status
+  SPI1.slave.val &= ~0x1F;
+
+  // Trigger the latch signal - At this point the minimum time required for
+  // enabling the latch signal has lapsed
+  SET_LO(XLT_PORT);
+  DELAY (40);
+
+  SET_HI(XLT_PORT);
+
+  latch_command = tx_command;
+  latch_cycles  = soc_get_ccount();
+
+  tx_count++;
+
+  // A read of the channel Q waiting for the bus goes before the next command
+  if (bus_release(B_MICOM)) {
+    woken = pdTRUE;
+  }
+
+  if (tx_read_idx != tx_write_idx) {
+    bus_request(B_MICOM);
+  } else {
+    tx_busy = false;
+
+    timing_stats.n_bursts++;
+    timing_stats.n_commands         += tx_count;
+    timing_stats.last_burst_commands = tx_count;
+    timing_stats.last_burst_us       = CYCLES_TO_US(latch_cycles - tx_cycles);
+    timing_stats.total_burst_us     += timing_stats.last_burst_us;
+
+    xSemaphoreGiveFromISR(tx_semaphore, &woken);
+  }
+
+  if (woken == pdTRUE) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+static void IRAM_ATTR gpio_isr_cb() {
+  BaseType_t woken  = pdFALSE;
+  uint32_t   status = GPIO.status & (BIT(SENS_PORT) | BIT(FOK_PORT) | BIT(GFS_PORT) | BIT(SCOR_PORT) | BIT(TRCNT_PORT));
+
+  GPIO.status_w1tc = status;
+
+  // The SPI is shared with the MICOM interface so the frame is read once the
+  // command being transmitted, if any, is latched
+  if (status & BIT(SCOR_PORT)) {
+    if (subq_handle_scor()) {
+      woken = pdTRUE;
+    }
+
+    status &= ~BIT(SCOR_PORT);
+  }
+
+  if (status & BIT(SENS_PORT)) {
+    rise_cycles[LAT_SENS] = soc_get_ccount();
+
+    xSemaphoreGiveFromISR(sens_semaphore, &woken);
+  }
+
+  if (status & BIT(FOK_PORT)) {
+    rise_cycles[LAT_FOK] = soc_get_ccount();
+
+    fok_edges++;
+  }
+
+  if (status & BIT(TRCNT_PORT)) {
+    if (trc_handle_edge()) {
+      woken = pdTRUE;
+    }
+
+    status &= ~BIT(TRCNT_PORT);
+  }
+
+  // Wake up the action waiting on the level of any of the lines
+  if (status != 0 && action_task != NULL) {
+    vTaskNotifyGiveFromISR(action_task, &woken);
+  }
+
+  if (woken == pdTRUE) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+// Writes an event to the ring - Must be called in a critical section
+static void IRAM_ATTR write_event(ctl_status status) {
+  TEvent* event = &event_ring[event_sequence % EVENT_RING_SIZE];
 
-static void IRAM_ATTR notify_update(ctl_status status) {
-  TEvent event;
+  event->sequence    = event_sequence;
+  event->is_busy     = IS_BUSY    (status);
+  event->is_powered  = IS_POWERED (status);
+  event->status_text = STATUS_TEXT(status);
+
+  event_sequence++;
+}
 
-  event.is_busy     = IS_BUSY    (status);
-  event.is_powered  = IS_POWERED (status);
-  event.status_text = STATUS_TEXT(status);
+// Wakes up the subscribers waiting on new events - This never blocks
+static void IRAM_ATTR notify_subscribers() {
+  for (size_t i = 0; i < n_subscribers; i++) {
+    TaskHandle_t task = subscribers[i].task;
 
-  for (size_t i = 0; i < n_listeners; i++) {
-    listeners[i](&event);
+    if (task != NULL) {
+      xTaskNotifyGive(task);
+    }
   }
 }
 
@@ -125,10 +494,14 @@ static void IRAM_ATTR set_status(ctl_status status) {
   current_status    = controller_status;
   controller_status = status;
 
+  if (status != current_status) {
+    write_event(status);
+  }
+
   portEXIT_CRITICAL();
 
   if (status != current_status) {
-    notify_update(status);
+    notify_subscribers();
   }
 }
 
@@ -137,126 +510,250 @@ static bool IRAM_ATTR try_lock() {
 
   portENTER_CRITICAL();
 
-  is_ready           = IS_POWERED(controller_status) && !IS_BUSY(controller_status);
-  controller_status |= BUSY_BIT;
+  is_ready = IS_POWERED(controller_status) && !IS_BUSY(controller_status);
+
+  if (is_ready) {
+    controller_status |= BUSY_BIT;
+  }
 
   portEXIT_CRITICAL();
 
   return is_ready;
 }
 
-static void IRAM_ATTR run_action(void* action_fn) {
-  if (try_lock()) {
-    ((void(*)()) action_fn)();
-  }
-
-  vTaskDelete(NULL);
-}
-
 // <-- Controller Actions
 
-static void IRAM_ATTR send(uint16_t command) {
-  // Enable the command phase
-  SPI1.user.usr_command         = 1;
+// Queues a command of the given length in bits, or the length given by the MICOM
+// command table if 0
+static void IRAM_ATTR transmit(uint16_t command, uint8_t bits) {
+  uint32_t request_us;
 
-  // Set the command and the length
-  SPI1.user2.usr_command_value  = command;
-  SPI1.user2.usr_command_bitlen = command <= 0xFF
-                                ? 7
-                                : command <= 0xFFF
-                                ? 11
-                                : 15;
+  if (request_cycles != 0) {
+    request_us     = CYCLES_TO_US(soc_get_ccount() - request_cycles);
+    request_cycles = 0;
 
-  // Start the operation
-  SPI1.cmd.usr                  = 1;
+    portENTER_CRITICAL();
 
-  // Wait for the operation to complete
-  while (SPI1.cmd.usr == 1);
+    timing_stats.n_requests++;
+    timing_stats.last_request_us   = request_us;
+    timing_stats.max_request_us    = request_us > timing_stats.max_request_us ? request_us : timing_stats.max_request_us;
+    timing_stats.total_request_us += request_us;
 
-  // Trigger the latch signal - At this point the minimum time required for
-  // enabling the latch signal has lapsed
+    portEXIT_CRITICAL();
+  }
+
+  // Wait for room in the queue - This only happens on bursts longer than the
+  // queue and it takes a few uS per command
+  while ((tx_write_idx + 1) % TX_QUEUE_SIZE == tx_read_idx);
 
   portENTER_CRITICAL();
 
-  SET_LO(XLT_PORT);
-  DELAY (40);
+  if (bits == 0) {
+    bits = micom_bits(command);
+  }
 
-  SET_HI(XLT_PORT);
+  tx_queue[tx_write_idx] = ((uint32_t) bits << 16) | command;
+  tx_write_idx           = (tx_write_idx + 1) % TX_QUEUE_SIZE;
+
+  if (!tx_busy) {
+    tx_busy   = true;
+    tx_count  = 0;
+    tx_cycles = soc_get_ccount();
+
+    bus_request(B_MICOM);
+  }
 
   portEXIT_CRITICAL();
 }
 
-static void IRAM_ATTR reset() {
-  set_status(S_RESET_IN_PROGRESS | BUSY_BIT);
+// The length of a constant command is resolved at compile time
+static inline void IRAM_ATTR send(uint16_t command) {
+  transmit(command, micom_bits(command));
+}
 
-  // Reset both ICs
-  SET_LO(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
+// Waits for all the queued MICOM commands to be transmitted and latched. This
+// must be called before doing anything that depends on the commands sent, e.g.
+// changing the reset line or checking SENS or FOK
+static void IRAM_ATTR flush() {
+  if (!tx_busy) {
+    return;
+  }
 
-  // Disable the reset line and send few commands that apparently are required
-  // or the SERVO IC behaves erratically
-  SET_HI(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
+  while (tx_busy) {
+    xSemaphoreTake(tx_semaphore, 1);
+  }
+}
+
+// Records the time from the latch signal of the last command until the rising
+// edge of a line, provided the line went high after the command was latched
+static void IRAM_ATTR record_completion(uint8_t line) {
+  uint32_t rise = rise_cycles[line];
+
+  if (rise != 0 && (int32_t) (rise - latch_cycles) >= 0) {
+    lat_record(latch_command, line, CYCLES_TO_US(rise - latch_cycles));
+  }
+}
+
+// Sends a command of the given length in bits, or the length given by the MICOM
+// command table if 0, and, if the command signals its completion through SENS,
+// waits for the rising edge of SENS or the timeout to expire
+static uint8_t IRAM_ATTR transmit_and_wait(uint16_t command, uint8_t bits) {
+  if (bits == 0) {
+    bits = micom_bits(command);
+  }
+
+  if (!micom_is_sens(command, bits)) {
+    transmit(command, bits);
+
+    return M_SENT;
+  }
+
+  // Discard any edge caused by a previous command
+  xSemaphoreTake(sens_semaphore, 0);
+
+  rise_cycles[LAT_SENS] = 0;
+
+  transmit(command, bits);
+  flush();
+
+  // A command completed before SENS is seen low leaves no rising edge, so the
+  // level is checked too once the command has had time to pull SENS low and
+  // again on the timeout
+  if (
+    xSemaphoreTake(sens_semaphore, MICOM_SENS_SETTLE_MS / portTICK_RATE_MS) == pdTRUE ||
+    gpio_get_level(SENS_PORT) == 1 ||
+    xSemaphoreTake(sens_semaphore, (MICOM_SENS_TIMEOUT_MS - MICOM_SENS_SETTLE_MS) / portTICK_RATE_MS) == pdTRUE ||
+    gpio_get_level(SENS_PORT) == 1
+  ) {
+    // The semaphore is given on cancellation too so the wait is interrupted
+    if (cancel_requested) {
+      return M_CANCELLED;
+    }
+
+    record_completion(LAT_SENS);
+
+    return M_COMPLETED;
+  }
+
+  return cancel_requested ? M_CANCELLED : M_TIMED_OUT;
+}
 
+static inline uint8_t IRAM_ATTR send_and_wait(uint16_t command) {
+  return transmit_and_wait(command, micom_bits(command));
+}
+
+// Stops all the servos, cancels any auto-sequence command and sets the reset
+// line low. This is the safe state the controller is left in after any action
+static void IRAM_ATTR shutdown() {
   send(0x00); // Stop focus servo
   send(0x10); // Reset tracking control
   send(0x20); // Stop both tracking and sled servos
   send(0x40); // Cancel any auto-sequence command
   send(0xe0); // Stop CLV
 
+  flush();
+
   // Keep both ICs in reset state
   SET_LO(XRST_PORT);
   vTaskDelay(10 / portTICK_RATE_MS);
+}
 
-  set_status(S_IDLE);
+// Waits for the given time in mS unless the running action is cancelled
+//
+// @returns true, if the action has been cancelled; false, otherwise.
+static bool IRAM_ATTR wait_ms(uint32_t ms) {
+  TickType_t start = xTaskGetTickCount();
+  TickType_t ticks = ms / portTICK_RATE_MS;
+  TickType_t elapsed;
+
+  // Only an action can be cancelled (see WAIT)
+  configASSERT(xTaskGetCurrentTaskHandle() == action_task);
+
+  // The task is also notified on sampler events so keep waiting until the time
+  // has lapsed
+  while (!cancel_requested && (elapsed = xTaskGetTickCount() - start) < ticks) {
+    ulTaskNotifyTake(pdTRUE, ticks - elapsed);
+  }
+
+  return cancel_requested;
 }
 
-static void IRAM_ATTR move_pickup_to_initial_position() {
-  uint8_t t = 0;
+// Waits for the limit switch to be pressed or the timeout to expire, whichever
+// occurs first. The task is notified by the sampler on every state change
+static bool IRAM_ATTR wait_for_limit_switch(uint32_t timeout_ms) {
+  TickType_t start = xTaskGetTickCount();
+  TickType_t ticks = timeout_ms / portTICK_RATE_MS;
+  TickType_t elapsed;
 
-  set_status(S_PICKUP_TO_INITIAL_POSITION | BUSY_BIT);
+  while ((smp_get_state() & SMP_LIMIT_SWITCH) == 0) {
+    if (cancel_requested || (elapsed = xTaskGetTickCount() - start) >= ticks) {
+      return false;
+    }
+
+    ulTaskNotifyTake(pdTRUE, ticks - elapsed);
+  }
+
+  return true;
+}
+
+static void IRAM_ATTR reset() {
+  set_status(S_RESET_IN_PROGRESS | BUSY_BIT);
 
+  // Reset both ICs
   SET_LO(XRST_PORT);
   vTaskDelay(10 / portTICK_RATE_MS);
 
+  // Disable the reset line and send few commands that apparently are required
+  // or the SERVO IC behaves erratically
   SET_HI(XRST_PORT);
   vTaskDelay(10 / portTICK_RATE_MS);
 
-  send(0x23); // Reverse kick
+  shutdown();
 
-  frc1.load.data = US_TO_TICKS(1000000);
-  frc1.ctrl.en   = 1;
+  // The disc may have been replaced
+  subq_reset_toc();
 
-  while (t < OPERATION_TIMEOUT_S) {
-    vTaskSuspendAll();
-    uint16_t v = test_tout();
-    xTaskResumeAll ();
+  set_status(S_IDLE);
+}
 
-    if (v >= PICKUP_LIMIT_SW_MIN && v <= PICKUP_LIMIT_SW_MAX) {
-      break;
-    }
+// Waits for the optical pickup to hit the limit switch once the reverse kick
+// has been sent. The timeout is the worst case of any mechanism; every homing
+// time measured is fed back to the profile, which counts the slow ones
+static bool IRAM_ATTR home_pickup() {
+  TickType_t start = xTaskGetTickCount();
 
-    if (frc1.ctrl.en == 0 && ++t < OPERATION_TIMEOUT_S) {
-      frc1.load.data = US_TO_TICKS(1000000);
-      frc1.ctrl.en   = 1;
-    }
+  if (!wait_for_limit_switch(OPERATION_TIMEOUT_S * 1000)) {
+    return false;
   }
 
-  send(0x00);
-  send(0x10);
-  send(0x20);
-  send(0x40);
-  send(0xe0);
+  profile_update_homing((xTaskGetTickCount() - start) * portTICK_RATE_MS);
+
+  return true;
+}
+
+static void IRAM_ATTR move_pickup_to_initial_position() {
+  set_status(S_PICKUP_TO_INITIAL_POSITION | BUSY_BIT);
 
   SET_LO(XRST_PORT);
   vTaskDelay(10 / portTICK_RATE_MS);
 
-  set_status(t == OPERATION_TIMEOUT_S ? S_ERROR_TIMED_OUT : S_IDLE);
+  SET_HI(XRST_PORT);
+  vTaskDelay(10 / portTICK_RATE_MS);
+
+  send(0x23); // Reverse kick
+
+  bool found = home_pickup();
+
+  if (cancel_requested) {
+    return;
+  }
+
+  shutdown();
+
+  set_status(found ? S_IDLE : S_ERROR_TIMED_OUT);
 }
 
 static void IRAM_ATTR move_pickup_to_initial_position_then_move_it_back() {
-  uint8_t t = 0;
-
   set_status(S_PICKUP_TO_INITIAL_POSITION | BUSY_BIT);
 
   SET_LO(XRST_PORT);
@@ -267,223 +764,249 @@ static void IRAM_ATTR move_pickup_to_initial_position_then_move_it_back() {
 
   send(0x23); // Reverse kick
 
-  frc1.load.data = US_TO_TICKS(1000000);
-  frc1.ctrl.en   = 1;
-
-  while (t < OPERATION_TIMEOUT_S) {
-    vTaskSuspendAll();
-    uint16_t v = test_tout();
-    xTaskResumeAll ();
-
-    if (v >= PICKUP_LIMIT_SW_MIN && v <= PICKUP_LIMIT_SW_MAX) {
-      break;
-    }
+  bool found = home_pickup();
 
-    if (frc1.ctrl.en == 0 && ++t < OPERATION_TIMEOUT_S) {
-      frc1.load.data = US_TO_TICKS(1000000);
-      frc1.ctrl.en   = 1;
-    }
+  if (cancel_requested) {
+    return;
   }
 
-  if (t < OPERATION_TIMEOUT_S) {
+  if (found) {
     send(0x20); // Stop sled servo
 
     set_status(S_PICKUP_MOVE_BACKWARDS | BUSY_BIT);
 
     send(0x22); // Forward kick
 
-    frc1.load.data = US_TO_TICKS(1000000);
-    frc1.ctrl.en   = 1;
-
-    while (frc1.ctrl.en == 1);
+    WAIT(1000);
   }
 
-  send(0x00);
-  send(0x10);
-  send(0x20);
-  send(0x40);
-  send(0xe0);
-
-  SET_LO(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
+  shutdown();
 
-  set_status(t == OPERATION_TIMEOUT_S ? S_ERROR_TIMED_OUT : S_IDLE);
+  set_status(found ? S_IDLE : S_ERROR_TIMED_OUT);
 }
 
-static void IRAM_ATTR run_test_coils_and_motors() {
-  SET_LO(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
+// Waits for the level of the given port to be high or the timeout to expire,
+// whichever occurs first. A timeout of 0 just samples the level
+static bool IRAM_ATTR wait_for_high(gpio_num_t port, uint32_t timeout_ms) {
+  TickType_t start = xTaskGetTickCount();
+  TickType_t ticks = timeout_ms / portTICK_RATE_MS;
+  TickType_t elapsed;
+  bool       is_high;
+
+  // The edges before the last command is latched are not taken for its
+  // completion
+  if (port == SENS_PORT || port == FOK_PORT) {
+    rise_cycles[port == SENS_PORT ? LAT_SENS : LAT_FOK] = 0;
+  }
 
-  SET_HI(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
+  // The task is woken up on the rising edge. FOK and GFS may toggle at a high
+  // rate while playing so their interrupt is only enabled while waiting on them,
+  // from before the last command is latched so an early rise is timestamped
+  if (port != SENS_PORT) {
+    GPIO.pin[port].int_type = GPIO_INTR_POSEDGE;
+  }
 
-  // Move the lens along the X axis (tracking)
-  set_status(S_TESTING_TRACKING_COIL | BUSY_BIT);
+  flush();
 
-  for (size_t i = 0; i < 4; i++) {
-    send(0x20);
-    vTaskDelay(100 / portTICK_RATE_MS);
+  while (!(is_high = gpio_get_level(port) == 1)) {
+    if (cancel_requested || (elapsed = xTaskGetTickCount() - start) >= ticks) {
+      break;
+    }
 
-    send(0x2C);
-    vTaskDelay(100 / portTICK_RATE_MS);
+    ulTaskNotifyTake(pdTRUE, ticks - elapsed);
+  }
 
-    send(0x20);
-    vTaskDelay(100 / portTICK_RATE_MS);
+  if (port != SENS_PORT) {
+    GPIO.pin[port].int_type = GPIO_INTR_DISABLE;
+  }
 
-    send(0x28);
-    vTaskDelay(100 / portTICK_RATE_MS);
+  if (is_high && (port == SENS_PORT || port == FOK_PORT)) {
+    record_completion(port == SENS_PORT ? LAT_SENS : LAT_FOK);
   }
 
-  send(0x20);
+  return is_high;
+}
 
-  // Move the optical pickup along the X axis (sled motor)
-  set_status(S_TESTING_SLED_MOTOR | BUSY_BIT);
+// Prints the time spent in each phase of a script, if any, together with the
+// time elapsed since the script started at the end of each phase
+static void IRAM_ATTR report_phases(const char* name, const uint32_t* phase_cycles) {
+  uint32_t total_us = 0;
 
-  for (size_t i = 0; i < 4; i++) {
-    send(0x23);
-    vTaskDelay(100 / portTICK_RATE_MS);
+  for (size_t i = 0; i < PH_COUNT; i++) {
+    if (phase_cycles[i] == 0) {
+      continue;
+    }
 
-    send(0x20);
-    vTaskDelay(100 / portTICK_RATE_MS);
+    if (total_us == 0) {
+      printf("Timing of %s:\n", name);
+    }
 
-    send(0x22);
-    vTaskDelay(100 / portTICK_RATE_MS);
+    total_us += CYCLES_TO_US(phase_cycles[i]);
 
-    send(0x20);
-    vTaskDelay(100 / portTICK_RATE_MS);
+    printf("  %-16s %6u mS (at %6u mS)\n",
+      phase_text[i],
+      CYCLES_TO_US(phase_cycles[i]) / 1000,
+      total_us / 1000
+    );
   }
+}
 
-  send(0x20);
-
-  // Move the lens up and down (focus)
-  set_status(S_TESTING_FOCUS_COIL | BUSY_BIT);
-
-  for (size_t i = 0; i < 4; i++) {
-    send(0x47);
-    vTaskDelay(500 / portTICK_RATE_MS);
-
-    send(0x40);
-    vTaskDelay(500 / portTICK_RATE_MS);
+// Runs the given script without setting its final status, so an action can go
+// on once it ends - See script.h for a description of the operations
+//
+// @returns the final status of the script; S_IDLE, if it is cancelled.
+static ctl_status IRAM_ATTR exec_script(const char* name) {
+  size_t   n       = script_load(name, script_code);
+  size_t   pc      = 0;
+  uint16_t counter = 0;
+  bool     flag    = false;
+  int32_t  phase   = -1;
+  uint32_t phase_start;
+  uint32_t phase_cycles[PH_COUNT] = { 0 };
+
+  if (n == 0) {
+    return S_UNEXPECTED_ERROR;
   }
 
-  // Move the spindle motor in both directions
-  set_status(S_TESTING_SPINDLE_MOTOR | BUSY_BIT);
+  while (pc < n && !cancel_requested) {
+    uint16_t op  = SCRIPT_OP_CODE(script_code[pc]);
+    uint16_t arg = SCRIPT_OP_ARG (script_code[pc]);
 
-  send(0xe8);
-  vTaskDelay(1000 / portTICK_RATE_MS);
+    pc++;
 
-  send(0xe0);
-  vTaskDelay(1000 / portTICK_RATE_MS);
+    switch (op) {
+    case OP_END:
+      if (phase >= 0) {
+        phase_cycles[phase] += soc_get_ccount() - phase_start;
 
-  send(0xea);
-  vTaskDelay(1000 / portTICK_RATE_MS);
+        report_phases(name, phase_cycles);
+      }
 
-  send(0xe0);
-  vTaskDelay(1000 / portTICK_RATE_MS);
+      return arg < S_COUNT ? arg : S_UNEXPECTED_ERROR;
 
-  send(0x00);
-  send(0x10);
-  send(0x20);
-  send(0x40);
-  send(0xe0);
+    case OP_SEND:
+      send(arg);
+      break;
 
-  SET_LO(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
+    case OP_DELAY:
+      if (wait_ms(arg)) {
+        return S_IDLE;
+      }
+      break;
 
-  set_status(S_IDLE);
-}
+    case OP_WAIT_SENS:
+      flag = wait_for_high(SENS_PORT, arg);
+      break;
 
-static void IRAM_ATTR play() {
-  uint32_t status = controller_status & STATUS_MASK;
+    case OP_WAIT_FOK:
+      flag = wait_for_high(FOK_PORT , arg);
+      break;
 
-  if (status != S_PLAYING && status != S_PAUSED) {
-    bool got_focus = false;
-    bool got_error = false;
+    case OP_JUMP:
+      pc = arg;
+      break;
 
-    SET_LO(XRST_PORT);
-    vTaskDelay(10 / portTICK_RATE_MS);
+    case OP_JUMP_IF:
+      pc = flag ? arg : pc;
+      break;
 
-    SET_HI(XRST_PORT);
-    vTaskDelay(10 / portTICK_RATE_MS);
+    case OP_JUMP_IF_NOT:
+      pc = flag ? pc : arg;
+      break;
+
+    case OP_SET_COUNTER:
+      counter = arg;
+      break;
 
-    set_status(S_LOOKING_FOR_DISC | BUSY_BIT);
+    case OP_LOOP:
+      if (counter > 0 && --counter > 0) {
+        pc = arg;
+      }
+      break;
 
-    // Adjust focus error bias
-    send(0x878);
-    send(0x87f);
-    send(0x841);
+    case OP_SET_STATUS:
+      if (arg < S_COUNT) {
+        set_status(arg | BUSY_BIT);
+      }
+      break;
 
-    vTaskDelay(100 / portTICK_RATE_MS);
+    case OP_SET_XRST:
+      flush();
 
-    if (gpio_get_level(SENS_PORT) == 0) {
-      got_error = true;
+      if (arg == 0) {
+        SET_LO(XRST_PORT);
+      } else {
+        SET_HI(XRST_PORT);
+      }
 
-      goto reset;
-    }
+      vTaskDelay(10 / portTICK_RATE_MS);
+      break;
 
-    // Adjust focus servo offset cancel
-    send(0x08 );
+    case OP_SHUTDOWN:
+      shutdown();
+      break;
 
-    send(0x867);
-    vTaskDelay(200 / portTICK_RATE_MS);
+    case OP_SEND_AND_WAIT:
+      // A command not known to signal its completion through SENS is given the
+      // settle time and its result is taken from the level of SENS, as the
+      // scripts did with a delay and a WAIT_SENS before this operation existed
+      switch (send_and_wait(arg)) {
+      case M_SENT:
+        if (wait_ms(MICOM_SENS_SETTLE_MS)) {
+          return S_IDLE;
+        }
 
-    send(0x86f);
-    send(0x842);
+        flag = gpio_get_level(SENS_PORT) == 1;
+        break;
 
-    vTaskDelay(100 / portTICK_RATE_MS);
+      case M_COMPLETED:
+        flag = true;
+        break;
 
-    if (gpio_get_level(SENS_PORT) == 0) {
-      got_error = true;
+      default:
+        flag = false;
+        break;
+      }
+      break;
 
-      goto reset;
-    }
+    case OP_WAIT_GFS:
+      flag = wait_for_high(GFS_PORT , arg);
+      break;
 
-    // Laser on
-    send(0x854);
+    case OP_SEND_PROFILE:
+      send(profile_command(arg));
+      break;
 
-    // Look for focus
-    for (size_t i = 0; i < 3 && !got_focus; i++) {
-      send(0x47);
-      vTaskDelay(500 / portTICK_RATE_MS);
+    case OP_MARK:
+      flush();
 
-      got_focus = gpio_get_level(FOK_PORT) == 1;
-    }
+      if (phase >= 0) {
+        phase_cycles[phase] += soc_get_ccount() - phase_start;
+      }
 
-    if (!got_focus) {
-      goto reset;
+      phase       = arg;
+      phase_start = soc_get_ccount();
+      break;
     }
+  }
 
-    send(0x99 ); // Set CNTL-Z register
-    send(0xae ); // Set CNTL-S register
-    send(0xe6 ); // Set CNTL-C register
-    send(0x20 ); // Disable tracking and sled servos
-    send(0x08 ); // Enable focus
-    send(0x844); // Set tracking balance
-    send(0x80b);
-    send(0x848); // Set tracking gain
-    send(0x827);
-    send(0x840);
-    send(0x25 ); // Enable tracking and sled servos
-    send(0x18 ); // Enable anti-shock and release the brake
+  return S_IDLE;
+}
 
-    goto done;
+// Runs the given script and sets its final status
+static void IRAM_ATTR run_script(const char* name) {
+  set_status(exec_script(name));
+}
 
-reset:
-    send(0x00);
-    send(0x10);
-    send(0x20);
-    send(0x40);
-    send(0xe0);
+static void IRAM_ATTR run_test_coils_and_motors() {
+  run_script(SCRIPT_TEST);
+}
 
-    SET_LO(XRST_PORT);
-    vTaskDelay(10 / portTICK_RATE_MS);
+static void IRAM_ATTR play() {
+  uint32_t status = controller_status & STATUS_MASK;
 
-done:
-    if (got_error) {
-      set_status(S_UNEXPECTED_ERROR);
-    } else {
-      set_status(got_focus ? S_PLAYING : S_NO_DISC);
-    }
+  if (status != S_PLAYING && status != S_PAUSED) {
+    run_script(SCRIPT_PLAY);
   } else {
     if (status == S_PLAYING) {
       send(0x20);
@@ -504,229 +1027,1623 @@ static void IRAM_ATTR stop() {
     send(0x85c); // Laser Off
 
     move_pickup_to_initial_position();
+
+    // The disc may be replaced once stopped
+    subq_reset_toc();
   }
 }
 
 static void IRAM_ATTR tune_tracking() {
-  bool got_focus = false;
-  bool got_error = false;
-
   move_pickup_to_initial_position();
 
-  SET_HI(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
-
-  set_status(S_LOOKING_FOR_DISC | BUSY_BIT);
+  if (cancel_requested) {
+    return;
+  }
 
-  // Adjust focus error bias
-  send(0x878);
-  send(0x87f);
-  send(0x841);
+  run_script(SCRIPT_TUNE);
+}
 
-  vTaskDelay(100 / portTICK_RATE_MS);
+// Sets a tracking value and returns the ratio (%) of the time SENS is high once
+// the tracking error has settled; -1, if the action is cancelled
+static int32_t IRAM_ATTR probe_tracking(uint16_t command) {
+  uint32_t high = 0;
 
-  if (gpio_get_level(SENS_PORT) == 0) {
-    got_error = true;
+  send(command);
+  flush();
 
-    goto reset;
+  if (wait_ms(TRACKING_SETTLE_MS)) {
+    return -1;
   }
 
-  // Adjust focus servo offset cancel
-  send(0x08 );
+  for (uint32_t i = 0; i < TRACKING_SAMPLES; i++) {
+    high += gpio_get_level(SENS_PORT);
 
-  send(0x867);
-  vTaskDelay(200 / portTICK_RATE_MS);
+    ets_delay_us(TRACKING_SAMPLE_US);
+  }
 
-  send(0x86f);
-  send(0x842);
+  tracking_calibration.n_probes++;
 
-  vTaskDelay(100 / portTICK_RATE_MS);
+  return high * 100 / TRACKING_SAMPLES;
+}
 
-  if (gpio_get_level(SENS_PORT) == 0) {
-    got_error = true;
+// Looks for the value whose ratio is the closest to the target. Both ends are
+// probed first so the search does not depend on the polarity of the window; if
+// there is no crossing within the range the closest end is used. Otherwise, the
+// range holding the crossing is halved until a value within the tolerance is
+// found or the range cannot be halved anymore
+static int32_t IRAM_ATTR search_tracking(uint16_t base, int32_t target) {
+  int32_t lo = 0;
+  int32_t hi = TRACKING_MAX_VALUE;
+  int32_t r_lo;
+  int32_t r_hi;
+
+  if ((r_lo = probe_tracking(base | lo)) < 0) {
+    return -1;
+  }
 
-    goto reset;
+  if (abs(r_lo - target) <= TRACKING_TOLERANCE) {
+    return lo;
   }
 
-  // Laser on
-  send(0x854);
+  if ((r_hi = probe_tracking(base | hi)) < 0) {
+    return -1;
+  }
+
+  while (hi - lo > 1 && (r_lo < target) != (r_hi < target)) {
+    int32_t mid   = (lo + hi) / 2;
+    int32_t r_mid = probe_tracking(base | mid);
+
+    if (r_mid < 0) {
+      return -1;
+    }
+
+    if (abs(r_mid - target) <= TRACKING_TOLERANCE) {
+      return mid;
+    }
+
+    if ((r_mid < target) == (r_lo < target)) {
+      lo   = mid;
+      r_lo = r_mid;
+    } else {
+      hi   = mid;
+      r_hi = r_mid;
+    }
+  }
+
+  return abs(r_lo - target) <= abs(r_hi - target) ? lo : hi;
+}
+
+static void IRAM_ATTR calibrate_tracking() {
+  TickType_t start = xTaskGetTickCount();
+  int32_t    balance;
+  int32_t    gain;
+  TProfile   profile;
+
+  tracking_calibration.is_valid = false;
+  tracking_calibration.n_probes = 0;
+
+  // Set the environment as in TUNE TRACKING - The script leaves the controller
+  // idle if it succeeds
+  tune_tracking();
+
+  if (cancel_requested || (controller_status & STATUS_MASK) != S_IDLE) {
+    return;
+  }
+
+  set_status(S_CALIBRATING_TRACKING | BUSY_BIT);
+
+  // A cancellation requested once the script ended is noticed here
+  if (cancel_requested) {
+    return;
+  }
+
+  send(0x844); // Set the balance window
+
+  if ((balance = search_tracking(0x800, TRACKING_BALANCE_TARGET)) < 0) {
+    return;
+  }
+
+  send(0x800 | balance);
+  send(0x848); // Set the gain window
+
+  if ((gain = search_tracking(0x820, TRACKING_GAIN_TARGET)) < 0) {
+    return;
+  }
+
+  send(0x820 | gain);
+  send(0x840);
+
+  tracking_calibration.is_valid   = true;
+  tracking_calibration.balance    = balance;
+  tracking_calibration.gain       = gain;
+  tracking_calibration.elapsed_ms = (xTaskGetTickCount() - start) * portTICK_RATE_MS;
+
+  printf("Tracking balance = %x, gain = %x (%u probes in %u mS)\n",
+    0x800 | balance,
+    0x820 | gain,
+    tracking_calibration.n_probes,
+    tracking_calibration.elapsed_ms
+  );
+
+  // Keep the values in the profile so the calibration is not required again
+  profile_get(&profile);
+
+  profile.balance = balance;
+  profile.gain    = gain;
+
+  if (profile_store(&profile) != 0) {
+    printf("Failed to store the calibration profile\n");
+  }
+
+  shutdown();
+
+  set_status(S_IDLE);
+}
+
+// Returns the number of tracks from the start of the program area to the given
+// absolute time, which is negative before the program area. The radius grows
+// with the square root of the time as the disc is read at constant velocity
+static int32_t IRAM_ATTR track_of(int32_t atime) {
+  float r2 = CLV_R0_UM * CLV_R0_UM
+           + CLV_VELOCITY_UM_S * CLV_PITCH_UM * (atime / 75.0f) / (float) M_PI;
+
+  return (int32_t) ((sqrtf(r2 > 0 ? r2 : 0) - CLV_R0_UM) / CLV_PITCH_UM);
+}
+
+// Reads the position of the optical pickup from the first frame read after the
+// last move. The lead-in and the lead-out are mapped to absolute times before
+// and after the program area respectively
+//
+// @returns true, if a frame was read; false, if the timeout expired or the
+// action was cancelled.
+static bool IRAM_ATTR read_position(const TToc* toc, int32_t* position, uint8_t* tno) {
+  TSubQ q;
+
+  subq_skip(q_subscriber);
+
+  while (!cancel_requested) {
+    switch (subq_read(q_subscriber, &q, SEEK_Q_TIMEOUT_MS)) {
+    case Q_NONE:
+      return false;
+
+    case Q_OK:
+      *tno      = q.tno;
+      *position = q.tno == SUBQ_LEAD_IN  ? SEEK_LEAD_IN_FRAMES
+                : q.tno == SUBQ_LEAD_OUT ? (int32_t) toc->lead_out
+                : (int32_t) q.atime;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Enables the tracking and sled servos once the optical pickup has been moved
+// and waits for the frame lock, keeping the time it took
+static void IRAM_ATTR close_servos() {
+  uint32_t start = soc_get_ccount();
+
+  send(0x25); // Tracking and sled servos on
+
+  lock_ms = wait_for_high(GFS_PORT, SEEK_LOCK_TIMEOUT_MS)
+          ? CYCLES_TO_US(soc_get_ccount() - start) / 1000
+          : SEEK_LOCK_TIMEOUT_MS;
+}
+
+// Waits for the given number of track crossings counted on TRCNT. The time
+// estimated for them is used instead if no crossings are counted by then, e.g.
+// as TRCNT is not wired, and the wait is given up at twice that time otherwise
+//
+// @returns true, if the action is cancelled; false, otherwise.
+static bool IRAM_ATTR wait_for_crossings(uint32_t n, uint32_t ms) {
+  uint32_t   start = trc_get_count();
+  uint32_t   since = soc_get_ccount();
+  TickType_t begin = xTaskGetTickCount();
+  TickType_t ticks = ms / portTICK_RATE_MS;
+  TickType_t elapsed;
+
+  // Short kicks are timed by polling as they take less than a tick
+  if (ticks == 0) {
+    while (trc_get_count() - start < n) {
+      uint32_t us = CYCLES_TO_US(soc_get_ccount() - since);
+
+      if (us >= 2 * ms * 1000 || (us >= ms * 1000 && trc_get_count() == start)) {
+        break;
+      }
+    }
+
+    return cancel_requested;
+  }
+
+  trc_set_alarm(n);
+
+  while (!cancel_requested && trc_get_count() - start < n) {
+    TickType_t limit = trc_get_count() == start ? ticks : 2 * ticks;
+
+    if ((elapsed = xTaskGetTickCount() - begin) >= limit) {
+      break;
+    }
+
+    // The task is also notified on the lines and sampler events
+    ulTaskNotifyTake(pdTRUE, limit - elapsed);
+  }
+
+  trc_clear_alarm();
+
+  return cancel_requested;
+}
+
+// Moves the sled with the tracking servo off until the given number of tracks
+// are crossed, or for the time estimated for them, and then closes the servos
+//
+// @returns true, unless the action is cancelled.
+static bool IRAM_ATTR kick_sled(bool is_forward, uint32_t tracks, uint32_t ms) {
+  bool is_cancelled;
+
+  trc_begin_kick();
+
+  send(is_forward ? 0x22 : 0x23); // Forward/Reverse kick
+  flush();
+
+  is_cancelled = wait_for_crossings(tracks, ms);
+
+  trc_end_kick();
+
+  if (is_cancelled) {
+    return false;
+  }
+
+  close_servos();
+
+  return !cancel_requested;
+}
+
+// Jumps the given number of tracks, backwards if negative, as the original CPU
+// does on NEXT (005d 0066 0076 004c 0025): the timings of the jump are set, then
+// the count N and then the 2N track jump is run. The servos are closed again
+// once the jump is completed
+//
+// @returns true, unless the action is cancelled.
+static bool IRAM_ATTR jump_tracks(int32_t tracks) {
+  uint32_t n = abs(tracks) / 2;
+
+  n = n < 1 ? 1 : n > SEEK_FINE_MAX_TRACKS / 2 ? SEEK_FINE_MAX_TRACKS / 2 : n;
+
+  send(0x5d);     // Jump timings
+  send(0x66);
+  send(0x70 | n); // Jump count
+
+  if (send_and_wait(tracks > 0 ? 0x4c : 0x4d) == M_CANCELLED) {
+    return false;
+  }
+
+  close_servos();
+
+  return !cancel_requested;
+}
+
+// Makes sure the disc is being played and the table of contents is known. If
+// it is not the optical pickup is moved to the initial position first so the
+// table of contents is read from the lead-in. The given status is set once the
+// disc is being played
+static bool IRAM_ATTR prepare_seek(TToc* toc, ctl_status seek_status) {
+  uint32_t   status  = controller_status & STATUS_MASK;
+  bool       has_toc = subq_get_toc(toc);
+  TickType_t start;
+  TSubQ      q;
+
+  if (!has_toc) {
+    move_pickup_to_initial_position();
+
+    if (cancel_requested || (controller_status & STATUS_MASK) != S_IDLE) {
+      return false;
+    }
+
+    status = S_IDLE;
+  }
+
+  if (status == S_PAUSED) {
+    send(0x25);
+  } else if (status != S_PLAYING) {
+    // The status is kept busy as the seek goes on once the disc is played
+    status = exec_script(SCRIPT_PLAY);
+
+    if (cancel_requested) {
+      return false;
+    }
+
+    if (status != S_PLAYING) {
+      set_status(status);
+
+      return false;
+    }
+  }
+
+  set_status(seek_status | BUSY_BIT);
+
+  start = xTaskGetTickCount();
+
+  while (!has_toc && !cancel_requested) {
+    if ((xTaskGetTickCount() - start) * portTICK_RATE_MS >= SEEK_TOC_TIMEOUT_MS) {
+      shutdown();
+
+      set_status(S_ERROR_TIMED_OUT);
+
+      return false;
+    }
+
+    if (subq_read(q_subscriber, &q, SEEK_Q_TIMEOUT_MS) == Q_OK) {
+      has_toc = subq_get_toc(toc);
+    }
+  }
+
+  return has_toc;
+}
+
+// Resolves the target of a seek to an absolute time
+//
+// @returns the absolute time; -1, if the target is not on the disc.
+static int32_t IRAM_ATTR resolve_target(const TSeekTarget* target, const TToc* toc, uint8_t tno) {
+  uint8_t track = target->track;
+  int32_t atime;
+
+  if (track == SEEK_NEXT_TRACK) {
+    track = tno == SUBQ_LEAD_IN  ? toc->first
+          : tno == SUBQ_LEAD_OUT ? 0
+          : tno + 1;
+
+    if (track == 0) {
+      return -1;
+    }
+  }
+
+  if (track != 0) {
+    return track >= toc->first && track <= toc->last ? toc->start[track] : -1;
+  }
+
+  atime = SUBQ_FRAMES(target->min, target->sec, target->frame);
+
+  return target->sec < 60 && target->frame < 75 && atime < toc->lead_out ? atime : -1;
+}
+
+// Moves the optical pickup from the given position until the target is a bit
+// ahead, aiming at the middle of the window so a small error either way does
+// not need another move, and then plays the disc until the target is reached
+//
+// @returns true, if the target is reached; false, otherwise.
+static bool IRAM_ATTR seek_to(const TToc* toc, int32_t goal, int32_t* position, uint32_t* n_iterations) {
+  uint32_t kick_rate = SEEK_KICK_TRACKS_PER_MS;
+  uint8_t  tno;
+  TSubQ    q;
+
+  lock_ms = 0;
+
+  while (*position > goal || goal - *position > SEEK_TOLERANCE_FRAMES) {
+    int32_t distance = track_of(goal - SEEK_TOLERANCE_FRAMES / 2) - track_of(*position);
+    int32_t from     = *position;
+    bool    is_moved;
+
+    if ((*n_iterations)++ == SEEK_MAX_ITERATIONS) {
+      return false;
+    }
+
+    if (abs(distance) > SEEK_FINE_MAX_TRACKS) {
+      uint32_t        kick_ms = abs(distance) / kick_rate;
+      TTrackCrossings crossings;
+
+      // The learned speed may be high enough to round the kick down to nothing
+      kick_ms = kick_ms > 0 ? kick_ms : 1;
+
+      is_moved = kick_sled(distance > 0, abs(distance), kick_ms) && read_position(toc, position, &tno);
+
+      trc_get(&crossings);
+
+      if (is_moved && crossings.kick_us >= 1000) {
+        // Learn the speed of the sled so the next kick is closer if the
+        // crossings are not counted
+        uint32_t crossed = abs(track_of(*position) - track_of(from)) / (crossings.kick_us / 1000);
+
+        kick_rate = crossed > 0 ? crossed : 1;
+      }
+    } else {
+      is_moved = jump_tracks(distance) && read_position(toc, position, &tno);
+    }
+
+    if (!is_moved) {
+      return false;
+    }
+  }
+
+  // The frames left are bounded so a stuck optical pickup does not hang it
+  for (size_t i = 0; !cancel_requested && *position >= 0 && *position < goal; i++) {
+    if (i == 2 * SEEK_TOLERANCE_FRAMES) {
+      return false;
+    }
+
+    switch (subq_read(q_subscriber, &q, SEEK_Q_TIMEOUT_MS)) {
+    case Q_NONE:
+      return false;
+
+    case Q_OVERRUN:
+      // Nothing was read, the next read returns the oldest frame available
+      continue;
+    }
+
+    if (q.tno != SUBQ_LEAD_IN && q.tno != SUBQ_LEAD_OUT) {
+      *position = q.atime;
+    }
+  }
+
+  return !cancel_requested && *position >= goal && *position - goal <= SEEK_TOLERANCE_FRAMES;
+}
+
+static void IRAM_ATTR seek(const TSeekTarget* target) {
+  TickType_t start = xTaskGetTickCount();
+  TToc*      toc   = &seek_toc;
+  int32_t    goal;
+  int32_t    position;
+  uint8_t    tno;
+
+  seek_result.is_valid     = false;
+  seek_result.n_iterations = 0;
+
+  if (!prepare_seek(toc, S_SEEKING)) {
+    return;
+  }
+
+  if (!read_position(toc, &position, &tno)) {
+    if (!cancel_requested) {
+      shutdown();
+
+      set_status(S_ERROR_TIMED_OUT);
+    }
+
+    return;
+  }
+
+  if ((goal = resolve_target(target, toc, tno)) < 0) {
+    printf("The seek target is not on the disc\n");
+
+    set_status(S_PLAYING);
+
+    return;
+  }
+
+  seek_result.target     = goal;
+  seek_result.is_valid   = seek_to(toc, goal, &position, &seek_result.n_iterations);
+  seek_result.reached    = position < 0 ? 0 : position;
+  seek_result.latency_ms = (xTaskGetTickCount() - start) * portTICK_RATE_MS;
+
+  if (cancel_requested) {
+    return;
+  }
+
+  printf("Seek to " MSF_FORMAT " %s at " MSF_FORMAT " in %u mS (%u iterations)\n",
+    MSF(seek_result.target),
+    seek_result.is_valid ? "finished" : "failed",
+    MSF(seek_result.reached),
+    seek_result.latency_ms,
+    seek_result.n_iterations
+  );
+
+  if (!seek_result.is_valid) {
+    shutdown();
+
+    set_status(S_ERROR_TIMED_OUT);
+
+    return;
+  }
+
+  set_status(S_PLAYING);
+}
+
+// Plays the disc for a while at a point of the scan and measures the quality of
+// the reading. The drops of FOK are counted by the interrupt handler
+static void IRAM_ATTR dwell(uint32_t ms, TScanPoint* point) {
+  TSubQStats before;
+  TSubQStats after;
+  uint32_t   n_frames;
+
+  subq_get_stats(&before);
+
+  fok_edges                   = 0;
+  GPIO.pin[FOK_PORT].int_type = GPIO_INTR_NEGEDGE;
+
+  wait_ms(ms);
+
+  GPIO.pin[FOK_PORT].int_type = GPIO_INTR_DISABLE;
+
+  subq_get_stats(&after);
+
+  n_frames            = after.n_frames - before.n_frames;
+
+  point->n_frames     = n_frames;
+  point->crc_errors   = n_frames == 0
+                      ? 1000
+                      : (after.n_crc_errors - before.n_crc_errors) * 1000 / n_frames;
+  point->fok_dropouts = fok_edges > 0xFF ? 0xFF : fok_edges;
+}
+
+static void IRAM_ATTR scan(uint16_t spacing_s, uint16_t dwell_ms) {
+  TickType_t start    = xTaskGetTickCount();
+  TToc*      toc      = &seek_toc;
+  uint32_t   n_failed = 0;  // Consecutive points not reached
+  uint32_t   spacing;
+  uint32_t   n_iterations;
+  int32_t    position;
+  uint8_t    tno;
+
+  portENTER_CRITICAL();
+
+  scan_info.is_complete = false;
+  scan_info.n_points    = 0;
+
+  portEXIT_CRITICAL();
+
+  if (!prepare_seek(toc, S_SCANNING)) {
+    return;
+  }
+
+  spacing  = SUBQ_FRAMES(0, spacing_s > 0 ? spacing_s : SCAN_DEFAULT_SPACING_S, 0);
+  dwell_ms = dwell_ms  > 0 ? dwell_ms  : SCAN_DEFAULT_DWELL_MS;
+
+  // Widen the spacing if the points would not fit in the map
+  if ((toc->lead_out - toc->start[toc->first]) / spacing >= SCAN_MAX_POINTS) {
+    spacing = (toc->lead_out - toc->start[toc->first]) / SCAN_MAX_POINTS + 1;
+  }
+
+  scan_info.spacing = spacing;
+
+  printf("Scanning every %u S from " MSF_FORMAT " to " MSF_FORMAT "\n",
+    spacing / 75,
+    MSF(toc->start[toc->first]),
+    MSF(toc->lead_out)
+  );
+
+  for (
+    uint32_t atime = toc->start[toc->first];
+    atime < toc->lead_out && n_failed < SCAN_MAX_FAILURES && !cancel_requested;
+    atime += spacing
+  ) {
+    TScanPoint* point = &scan_points[scan_info.n_points];
+
+    n_iterations      = 0;
+
+    point->atime      = atime;
+    point->is_reached = read_position(toc, &position, &tno) &&
+                        seek_to(toc, atime, &position, &n_iterations);
+    point->lock_ms    = lock_ms;
+
+    if (cancel_requested) {
+      return;
+    }
+
+    if (point->is_reached) {
+      dwell(dwell_ms, point);
+
+      printf("  " MSF_FORMAT "  Lock %4u mS  CRC %4u/1000  FOK drops %3u\n",
+        MSF(atime),
+        point->lock_ms,
+        point->crc_errors,
+        point->fok_dropouts
+      );
+
+      n_failed = 0;
+    } else {
+      printf("  " MSF_FORMAT "  Not reached\n", MSF(atime));
+
+      // Start the disc again as the focus or the lock may have been lost for
+      // good, so the next point can be reached
+      if (++n_failed < SCAN_MAX_FAILURES) {
+        // The status is kept busy as the scan goes on, unless the disc cannot
+        // be played, as the ICs are shut down then
+        if (exec_script(SCRIPT_PLAY) == S_PLAYING) {
+          set_status(S_SCANNING | BUSY_BIT);
+        } else {
+          n_failed = SCAN_MAX_FAILURES;
+        }
+      }
+    }
+
+    // Publish the point only once it has been written
+    scan_info.n_points++;
+  }
+
+  if (cancel_requested) {
+    return;
+  }
+
+  scan_info.elapsed_ms  = (xTaskGetTickCount() - start) * portTICK_RATE_MS;
+  scan_info.is_complete = n_failed < SCAN_MAX_FAILURES;
+
+  printf("Scan %s after %u points in %u S\n",
+    scan_info.is_complete ? "finished" : "aborted",
+    scan_info.n_points,
+    scan_info.elapsed_ms / 1000
+  );
+
+  if (!scan_info.is_complete) {
+    shutdown();
+
+    set_status(S_ERROR_TIMED_OUT);
+
+    return;
+  }
+
+  set_status(S_PLAYING);
+}
+
+// Waits for the playback to be restored after a recovery step, which requires
+// the frame lock and then a couple of frames in sequence
+static bool IRAM_ATTR is_playback_restored() {
+  TickType_t start = xTaskGetTickCount();
+  uint32_t   last  = 0;
+  TSubQ      q;
+
+  if (!wait_for_high(GFS_PORT, RECOVERY_VERIFY_MS)) {
+    return false;
+  }
+
+  subq_skip(q_subscriber);
+
+  while (
+    !cancel_requested &&
+    (xTaskGetTickCount() - start) * portTICK_RATE_MS < RECOVERY_VERIFY_MS
+  ) {
+    if (
+      subq_read(q_subscriber, &q, SEEK_Q_TIMEOUT_MS) != Q_OK ||
+      q.tno == SUBQ_LEAD_IN                                 ||
+      q.tno == SUBQ_LEAD_OUT
+    ) {
+      continue;
+    }
+
+    if (last != 0 && q.atime > last && q.atime - last <= SUPERVISOR_MAX_GAP) {
+      return gpio_get_level(FOK_PORT) == 1;
+    }
+
+    last = q.atime;
+  }
+
+  return false;
+}
+
+// Runs the recovery steps from the given one until the playback is restored
+static void IRAM_ATTR recover(uint8_t first_step, TickType_t since, const TSeekTarget* target) {
+  bool     is_restored = false;
+  bool     is_focused  = false;
+  uint8_t  step;
+  uint32_t elapsed_ms;
+
+  set_status(S_RECOVERING | BUSY_BIT);
+
+  for (step = first_step; !is_restored && !cancel_requested && step < RC_COUNT; step++) {
+    switch (step) {
+    case RC_TRACKING:
+      send(0x25); // Enable tracking and sled servos
+
+      is_restored = is_playback_restored();
+      break;
+
+    case RC_FOCUS:
+      send(0x20); // Disable tracking and sled servos
+
+      for (size_t i = 0; !is_focused && !cancel_requested && i < RECOVERY_FOCUS_ATTEMPTS; i++) {
+        send(0x47);
+
+        is_focused = wait_for_high(FOK_PORT, RECOVERY_FOCUS_MS);
+      }
+
+      if (is_focused) {
+        send(0x08); // Enable focus
+        send(0x25); // Enable tracking and sled servos
+        send(0x18); // Enable anti-shock and release the brake
+
+        is_restored = is_playback_restored();
+      }
+      break;
+
+    case RC_SEEK:
+      // The loss happened before any frame in sequence was seen so there is no
+      // position to go back to
+      if (target->min == 0 && target->sec == 0 && target->frame == 0) {
+        break;
+      }
+
+      seek(target);
+
+      is_restored = seek_result.is_valid && (controller_status & STATUS_MASK) == S_PLAYING;
+      break;
+    }
+  }
+
+  if (cancel_requested) {
+    return;
+  }
+
+  elapsed_ms = (xTaskGetTickCount() - since) * portTICK_RATE_MS;
+
+  portENTER_CRITICAL();
+
+  if (is_restored) {
+    recovery_stats.n_recovered[step - 1]++;
+    recovery_stats.last_ms   = elapsed_ms;
+    recovery_stats.max_ms    = elapsed_ms > recovery_stats.max_ms ? elapsed_ms : recovery_stats.max_ms;
+    recovery_stats.total_ms += elapsed_ms;
+  } else {
+    recovery_stats.n_failed++;
+  }
+
+  portEXIT_CRITICAL();
+
+  if (!is_restored) {
+    printf("Failed to recover the playback\n");
+
+    shutdown();
+
+    set_status(S_UNEXPECTED_ERROR);
+
+    return;
+  }
+
+  printf("Playback recovered by %s in %u mS\n", recovery_text[step - 1], elapsed_ms);
+
+  set_status(S_PLAYING);
+}
+
+static void IRAM_ATTR run_user_script() {
+  set_status(S_RUNNING_SCRIPT | BUSY_BIT);
+
+  run_script(SCRIPT_USER);
+}
+
+static void IRAM_ATTR run_micom_commands(
+  size_t               n,
+  uint16_t*            commands,
+  ctl_micom_listener_t listener_fn
+) {
+  uint8_t* results = (uint8_t*) malloc(n * sizeof(uint8_t));
+
+  set_status(S_RUNNING_MICOM_COMMANDS | BUSY_BIT);
+
+  SET_LO(XRST_PORT);
+  vTaskDelay(10 / portTICK_RATE_MS);
+
+  SET_HI(XRST_PORT);
+  vTaskDelay(10 / portTICK_RATE_MS);
+
+  // Each command is paced by its actual completion rather than a fixed delay
+  for (size_t i = 0; i < n; i++) {
+    uint8_t result = cancel_requested ? M_CANCELLED : send_and_wait(commands[i]);
+
+    if (results != NULL) {
+      results[i] = result;
+    }
+  }
+
+  if (listener_fn != NULL && results != NULL) {
+    listener_fn(n, commands, results);
+  }
+
+  set_status(S_IDLE);
+
+  free(results);
+}
+
+// Sends a command of a replay once the time captured since the previous one,
+// scaled by the speed, has elapsed; otherwise, once the previous one completes
+//
+// @returns false, if the action is cancelled; true, otherwise.
+static bool IRAM_ATTR replay_command(const TReplayCommand* command, void* arg) {
+  TReplayState* state = (TReplayState*) arg;
+
+  if (cancel_requested) {
+    return false;
+  }
+
+  if (command->delay_us > 0 && state->n > 0) {
+    uint64_t scaled = (uint64_t) command->delay_us * 100 / state->speed_pct;
+    uint32_t delay  = scaled > REPLAY_MAX_DELAY_US ? REPLAY_MAX_DELAY_US : scaled;
+    uint32_t elapsed;
+
+    flush();
+
+    elapsed = CYCLES_TO_US(soc_get_ccount() - state->last);
+
+    if (elapsed < delay) {
+      // The whole ticks are slept, so a cancellation is noticed, and the last
+      // one is waited by polling so the command is sent on time
+      if (delay - elapsed >= 2 * portTICK_RATE_MS * 1000 && wait_ms((delay - elapsed) / 1000 - portTICK_RATE_MS)) {
+        return false;
+      }
+
+      while (CYCLES_TO_US(soc_get_ccount() - state->last) < delay);
+    } else if (elapsed - delay > state->max_late) {
+      state->max_late = elapsed - delay;
+    }
+  }
+
+  state->last = soc_get_ccount();
+
+  if (command->delay_us > 0) {
+    transmit(command->command, command->bits);
+  } else {
+    transmit_and_wait(command->command, command->bits);
+  }
+
+  state->n++;
+
+  return true;
+}
+
+// Replays a captured session, either the given text or the commands written by
+// the producer as they arrive. The time captured between two commands is kept,
+// scaled by the speed; otherwise, the commands are paced by their completion as
+// when running MICOM commands
+static void IRAM_ATTR replay(uint16_t speed_pct, const char* text) {
+  TickType_t     start    = xTaskGetTickCount();
+  bool           is_ended = false;
+  TReplayState   state    = { .speed_pct = speed_pct };
+  TReplayParser  parser;
+  TReplayCommand command;
+
+  set_status(S_REPLAYING | BUSY_BIT);
+
+  SET_LO(XRST_PORT);
+  vTaskDelay(10 / portTICK_RATE_MS);
+
+  SET_HI(XRST_PORT);
+  vTaskDelay(10 / portTICK_RATE_MS);
+
+  if (text != NULL) {
+    // The text has been checked by the producer
+    rpl_init(&parser);
+
+    is_ended = rpl_parse (&parser, text, strlen(text), replay_command, &state) == RPL_OK &&
+               rpl_finish(&parser, replay_command, &state)                     == RPL_OK;
+  }
+
+  while (text == NULL && !cancel_requested) {
+    if (xQueueReceive(replay_queue, &command, REPLAY_TIMEOUT_MS / portTICK_RATE_MS) != pdTRUE) {
+      break;
+    }
+
+    if (command.bits == REPLAY_END_BITS) {
+      is_ended = true;
 
-  // Look for focus
-  for (size_t i = 0; i < 3 && !got_focus; i++) {
-    send(0x47);
-    vTaskDelay(500 / portTICK_RATE_MS);
+      break;
+    }
 
-    got_focus = gpio_get_level(FOK_PORT) == 1;
+    if (!replay_command(&command, &state)) {
+      break;
+    }
   }
 
-  if (!got_focus) {
-    goto reset;
+  flush();
+
+  printf("Replayed %u MICOM commands in %u mS - The latest one was %u uS late\n",
+    state.n,
+    (xTaskGetTickCount() - start) * portTICK_RATE_MS,
+    state.max_late
+  );
+
+  if (text == NULL) {
+    is_replay_open = false;
+
+    xQueueReset(replay_queue);
   }
 
-  // Set the environment
-  send(0x08 );
-  send(0xe8 );
-  send(0x20 );
-  send(0x830);
+  set_status(is_ended || cancel_requested ? S_IDLE : S_ERROR_TIMED_OUT);
+}
 
-  // At this point, the user can run MICOM commands to find the right tracking
-  // balance and gain values
+// Controller Actions -->
 
-  goto done;
+// Waits for the controller to be ready for running an action. This may take a
+// while if the power task is resetting the controller
+static bool IRAM_ATTR wait_for_lock() {
+  while (!try_lock()) {
+    if (!IS_POWERED(controller_status)) {
+      return false;
+    }
 
-reset:
-  send(0x00);
-  send(0x10);
-  send(0x20);
-  send(0x40);
-  send(0xe0);
+    vTaskDelay(10 / portTICK_RATE_MS);
+  }
 
-  SET_LO(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
+  return true;
+}
 
-done:
-  if (got_error) {
-    set_status(S_UNEXPECTED_ERROR);
-  } else {
-    set_status(got_focus ? S_IDLE : S_NO_DISC);
+static void IRAM_ATTR run_actions_task() {
+  TRequest request;
+
+  while (true) {
+    if (xQueueReceive(action_queue, &request, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+
+    if (wait_for_lock()) {
+      portENTER_CRITICAL();
+
+      request_cycles    = request.cycles;
+      cancel_requested  = false;
+      is_action_running = true;
+
+      portEXIT_CRITICAL();
+
+      // Discard any notification left by a previous cancellation
+      ulTaskNotifyTake(pdTRUE, 0);
+
+      switch (request.action) {
+      case A_RESET:
+        reset();
+        break;
+
+      case A_MOVE_PICKUP_TO_INITIAL_POSITION:
+        move_pickup_to_initial_position();
+        break;
+
+      case A_MOVE_PICKUP_TO_INITIAL_POSITION_THEN_MOVE_IT_BACK:
+        move_pickup_to_initial_position_then_move_it_back();
+        break;
+
+      case A_RUN_TEST_COILS_AND_MOTORS:
+        run_test_coils_and_motors();
+        break;
+
+      case A_PLAY:
+        play();
+        break;
+
+      case A_STOP:
+        stop();
+        break;
+
+      case A_TUNE_TRACKING:
+        tune_tracking();
+        break;
+
+      case A_RUN_MICOM_COMMANDS:
+        run_micom_commands(request.n, request.commands, request.listener_fn);
+        break;
+
+      case A_RUN_USER_SCRIPT:
+        run_user_script();
+        break;
+
+      case A_CALIBRATE_TRACKING:
+        calibrate_tracking();
+        break;
+
+      case A_SEEK:
+        seek(&request.target);
+        break;
+
+      case A_RECOVER:
+        recover(request.step, request.since, &request.target);
+        break;
+
+      case A_SCAN:
+        scan(request.spacing_s, request.dwell_ms);
+        break;
+
+      case A_REPLAY:
+        replay(request.speed_pct, request.text);
+        break;
+      }
+
+      flush();
+
+      // The action returns as soon as it notices the cancellation leaving the
+      // controller in an unknown state, so put it in the safe state
+      if (cancel_requested) {
+        set_status(S_RESET_IN_PROGRESS | BUSY_BIT);
+
+        shutdown();
+
+        set_status(S_IDLE);
+      }
+
+      // Some actions may not change the status at all, e.g. STOP when there
+      // is no disc being played, so make sure the lock is released
+      if (IS_BUSY(controller_status)) {
+        set_status(controller_status & STATUS_MASK);
+      }
+
+      request_cycles    = 0;
+      is_action_running = false;
+    }
+
+    // The buffers for the MICOM commands and the sessions are owned by the
+    // controller
+    if (request.action == A_RUN_MICOM_COMMANDS) {
+      free(request.commands);
+    }
+
+    if (request.action == A_REPLAY) {
+      free(request.text);
+    }
   }
 }
 
-static void IRAM_ATTR run_micom_commands() {
-  set_status(S_RUNNING_MICOM_COMMANDS | BUSY_BIT);
+// Wakes up the action waiting on the limit switch on every change of the state
+static void IRAM_ATTR handle_smp_update(uint32_t state, uint16_t value) {
+  xTaskNotifyGive(action_task);
+}
 
-  SET_LO(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
+// Cancels the running action, if any, and drops the actions waiting to be run
+static void cancel_actions() {
+  TRequest request;
 
-  SET_HI(XRST_PORT);
-  vTaskDelay(10 / portTICK_RATE_MS);
+  while (xQueueReceive(action_queue, &request, 0) == pdTRUE) {
+    if (request.action == A_RUN_MICOM_COMMANDS) {
+      free(request.commands);
+    }
 
-  for (size_t i = 0; i < micom_task_n; i++) {
-    send(micom_task_commands[i]);
+    // The producer of the session is told there is no replay to write to
+    if (request.action == A_REPLAY && request.text == NULL) {
+      is_replay_open = false;
+    }
 
-    vTaskDelay(MICOM_CMD_DELAY_MS / portTICK_RATE_MS);
+    if (request.action == A_REPLAY) {
+      free(request.text);
+    }
   }
 
-  set_status(S_IDLE);
+  bool cancel;
 
-  // This task requires custom actions before disposing it
-  free(micom_task_commands);
+  portENTER_CRITICAL();
+
+  cancel = IS_BUSY(controller_status) || is_action_running;
+
+  if (cancel) {
+    cancel_requested = true;
+  }
 
-  vTaskDelete(NULL);
+  portEXIT_CRITICAL();
+
+  if (cancel) {
+    // Wake up the action if it is waiting on a delay or on SENS
+    xTaskNotifyGive(action_task);
+    xSemaphoreGive (sens_semaphore);
+  }
 }
 
-// Controller Actions -->
+static int32_t queue_action(TRequest* request) {
+  if (!IS_POWERED(controller_status)) {
+    return CTL_NOT_POWERED;
+  }
 
-static void IRAM_ATTR check_pwr_task() {
-  uint16_t v;
+  request->cycles = soc_get_ccount();
+
+  // Never block the caller - If the queue is full the request is rejected so
+  // the caller can try again later
+  if (xQueueSendToBack(action_queue, request, 0) != pdTRUE) {
+    return CTL_QUEUE_FULL;
+  }
+
+  return CTL_OK;
+}
+
+static int32_t queue_simple_action(uint8_t action) {
+  TRequest request = { .action = action };
+
+  return queue_action(&request);
+}
+
+static uint32_t IRAM_ATTR blink_led(void* arg) {
+  led_on = !led_on;
+
+  if (led_on) {
+    SET_LO(LED_PORT);
+
+    return LED_ON_MS * 1000;
+  }
+
+  SET_HI(LED_PORT);
+
+  return LED_OFF_MS * 1000;
+}
+
+// Watches the playback and queues a recovery once a loss lasts long enough. A
+// frame is in sequence if it follows the last one in sequence closely; frames
+// going back a little, as when the optical pickup skips back a track on every
+// revolution, count as stuck and frames far away from it count as a jump
+static void IRAM_ATTR supervise_task() {
+  int32_t    subscriber  = subq_subscribe();
+  bool       is_watching = false;
+  bool       is_done     = false; // Nothing else to watch until the disc is played again
+  uint32_t   good_atime  = 0;     // Absolute time of the last frame in sequence
+  uint32_t   n_stuck     = 0;     // Frames read since the last frame in sequence
+  uint8_t    loss        = L_NONE;
+  TickType_t loss_start  = 0;
+  TSubQ      q;
+
+  while (true) {
+    uint8_t  seen = L_NONE;
+    uint8_t  result;
+
+    // Only a playback that is neither paused nor being handled by an action is
+    // watched
+    if (controller_status != S_PLAYING || is_done) {
+      if (controller_status != S_PLAYING) {
+        is_done = false;
+      }
+
+      is_watching = false;
+
+      vTaskDelay(SUPERVISOR_CHECK_MS / portTICK_RATE_MS);
+      continue;
+    }
+
+    if (!is_watching) {
+      subq_skip(subscriber);
 
+      is_watching = true;
+      good_atime  = 0;
+      n_stuck     = 0;
+      loss        = L_NONE;
+    }
+
+    result = subq_read(subscriber, &q, SUPERVISOR_CHECK_MS);
+
+    if (gpio_get_level(FOK_PORT) == 0) {
+      seen = L_FOCUS;
+    } else if (gpio_get_level(GFS_PORT) == 0) {
+      seen = L_LOCK;
+    } else if (result == Q_NONE) {
+      seen = L_NO_FRAMES;
+    } else if (result == Q_OK && q.tno == SUBQ_LEAD_OUT) {
+      // The end of the disc has been reached
+      is_done = true;
+      continue;
+    } else if (result == Q_OK && q.tno != SUBQ_LEAD_IN) {
+      if (good_atime == 0 || (q.atime > good_atime && q.atime - good_atime <= SUPERVISOR_MAX_GAP)) {
+        good_atime = q.atime;
+        n_stuck    = 0;
+      } else if (q.atime > good_atime || good_atime - q.atime > SUPERVISOR_MAX_GAP) {
+        seen = L_JUMP;
+      } else if (++n_stuck >= SUPERVISOR_STUCK_FRAMES) {
+        seen = L_STUCK;
+      }
+    }
+
+    if (seen == L_NONE) {
+      loss = L_NONE;
+      continue;
+    }
+
+    if (loss == L_NONE) {
+      loss       = seen;
+      loss_start = xTaskGetTickCount();
+    }
+
+    // A jump or a stuck pickup is only noticed after a while so it is recovered
+    // straight away; the loss of a line must last a bit longer
+    if (
+      seen != L_JUMP && seen != L_STUCK &&
+      (xTaskGetTickCount() - loss_start) * portTICK_RATE_MS < SUPERVISOR_LOSS_MS
+    ) {
+      continue;
+    }
+
+    TRequest request = {
+      .action = A_RECOVER,
+      .step   = seen == L_JUMP  ? RC_SEEK
+              : seen == L_FOCUS ? RC_FOCUS
+              : RC_TRACKING,
+      .since  = loss_start,
+      // No frame in sequence has been seen yet if 0 - The seek is skipped
+      .target = {
+        .min    = good_atime / 4500,
+        .sec    = (good_atime / 75) % 60,
+        .frame  = good_atime % 75
+      }
+    };
+
+    printf("\a%s at " MSF_FORMAT "\n", loss_text[seen], MSF(good_atime));
+
+    if (queue_action(&request) == CTL_OK) {
+      portENTER_CRITICAL();
+
+      recovery_stats.n_losses++;
+
+      portEXIT_CRITICAL();
+
+      is_done = true;
+    }
+  }
+}
+
+static void IRAM_ATTR check_pwr_task() {
   while (true) {
     // If the controller is not busy running an operation then check whether it
     // is still powered up or not and update the status accordingly
     if (!IS_BUSY(controller_status)) {
-      vTaskSuspendAll();
-      v = test_tout();
-      xTaskResumeAll ();
-
-      if (v >= POWER_ON_STATUS_MIN && v <= POWER_ON_STATUS_MAX) {
+      if ((smp_get_state() & SMP_POWERED) != 0) {
         if (!IS_POWERED(controller_status)) {
           // Make sure LED is off
+          frc_cancel(led_timer);
+
+          led_timer = -1;
+          led_on    = false;
+
           SET_HI(LED_PORT);
 
+          // Back to the normal sampling rate for the limit switch
+          smp_set_idle(false);
+
           // Reset the controller - This will switch to IDLE status
           reset();
         }
       } else if (IS_POWERED(controller_status)) {
-        printf("ADC = %d\n", v);
+        printf("ADC = %d\n", smp_get_value());
 
         set_status(S_WAIT_FOR_POWER);
       }
+    }
 
-      if (!IS_POWERED(controller_status) && frc1.ctrl.en == 0) {
-        // It is safe to use the FRC timer at this point as if we are here it
-        // means the controller board has no power
+    if (IS_BUSY(controller_status)) {
+      vTaskDelay(POWER_CHECK_MS / portTICK_RATE_MS);
+    } else if (IS_POWERED(controller_status)) {
+      // Block until the power is lost
+      smp_wait(SMP_POWERED, 0, POWER_CHECK_MS);
+    } else {
+      // Blink the LED until the power is restored - The pattern is kept by the
+      // timer service and the ADC is sampled at the idle rate, so the CPU is
+      // halted most of the time while the task just waits for the power
+      if (led_timer < 0) {
+        led_timer = frc_add(0, blink_led, NULL);
 
-        if (gpio_get_level(LED_PORT) == 1) {
-          SET_LO(LED_PORT);
+        smp_set_idle(true);
+      }
 
-          frc1.load.data = US_TO_TICKS(LED_ON_US);
-        } else {
-          SET_HI(LED_PORT);
+      smp_wait(SMP_POWERED, SMP_POWERED, POWER_CHECK_MS);
+    }
+  }
+}
 
-          frc1.load.data = US_TO_TICKS(LED_OFF_US);
-        }
+void ctl_start() {
+  // Write the initial status so new subscribers always get an event
+  portENTER_CRITICAL();
+
+  write_event(controller_status);
+
+  portEXIT_CRITICAL();
+
+  action_queue   = xQueueCreate(ACTION_QUEUE_LENGTH, sizeof(TRequest));
+  sens_semaphore = xSemaphoreCreateBinary();
+  replay_queue   = xQueueCreate(REPLAY_QUEUE_LENGTH, sizeof(TReplayCommand));
+  tx_semaphore   = xSemaphoreCreateBinary();
+  q_subscriber   = subq_subscribe();
+
+  // Trigger an interrupt on the rising edge of SENS, which signals when an
+  // asynchronous command has been completed. The interrupt on SCOR has been
+  // set up by the channel Q reader
+  portENTER_CRITICAL();
+
+  _xt_isr_attach(ETS_GPIO_INUM, gpio_isr_cb, NULL);
+  _xt_isr_unmask(1 << ETS_GPIO_INUM);
+
+  GPIO.pin[SENS_PORT].int_type = GPIO_INTR_POSEDGE;
+
+  // Trigger an interrupt once a MICOM command has been transmitted, so the latch
+  // signal is triggered and the next command is transmitted without the CPU
+  // waiting on the SPI. The bus is shared with the channel Q so the commands
+  // are transmitted as it is granted
+  bus_set_handler(B_MICOM, transmit_next, 0);
+
+  _xt_isr_attach(ETS_SPI_INUM, spi_isr_cb, NULL);
+  _xt_isr_unmask(1 << ETS_SPI_INUM);
+
+  SPI1.slave.trans_inten = 1;
+
+  portEXIT_CRITICAL();
+
+  xTaskCreate(check_pwr_task  , "ctlTask"  , 1024, NULL, 1, NULL);
+  xTaskCreate(run_actions_task, "ctlAction", 1024, NULL, 1, &action_task);
+  xTaskCreate(supervise_task  , "ctlWatch" , 2048, NULL, 1, NULL);
+
+  // Wake up the action waiting on the limit switch as soon as it is pressed
+  smp_add_listener(handle_smp_update);
+}
+
+int32_t ctl_subscribe() {
+  int32_t id = -1;
+
+  portENTER_CRITICAL();
+
+  if (n_subscribers < MAX_SUBSCRIBERS) {
+    id = n_subscribers;
+
+    // Start from the last event, which holds the current status
+    subscribers[id].cursor = event_sequence > 0 ? event_sequence - 1 : 0;
+    subscribers[id].task   = NULL;
+
+    n_subscribers++;
+  }
+
+  portEXIT_CRITICAL();
+
+  return id;
+}
 
-        frc1.ctrl.en = 1;
+uint8_t ctl_read_event(int32_t subscriber, TEvent* event, uint32_t timeout_ms) {
+  TSubscriber* s     = &subscribers[subscriber];
+  TickType_t   start = xTaskGetTickCount();
+  TickType_t   ticks = timeout_ms / portTICK_RATE_MS;
+  TickType_t   elapsed;
+
+  s->task = xTaskGetCurrentTaskHandle();
+
+  while (true) {
+    uint32_t head = event_sequence;
+
+    if (head - s->cursor > EVENT_RING_SIZE) {
+      s->cursor = head - EVENT_RING_SIZE;
+
+      return E_OVERRUN;
+    }
+
+    if (s->cursor != head) {
+      *event = event_ring[s->cursor % EVENT_RING_SIZE];
+
+      // The event may have been overwritten while it was copied, which is
+      // reported as an overrun on the next iteration
+      if (event_sequence - s->cursor > EVENT_RING_SIZE) {
+        continue;
       }
+
+      s->cursor++;
+
+      return E_OK;
     }
 
-    if (IS_POWERED(controller_status)) {
-      vTaskDelay(500 / portTICK_RATE_MS);
-    } else {
-      portYIELD();
+    if ((elapsed = xTaskGetTickCount() - start) >= ticks) {
+      return E_NONE;
     }
+
+    // An event written after the check above leaves the notification pending
+    // so it is not missed
+    ulTaskNotifyTake(pdTRUE, ticks - elapsed);
   }
 }
 
-void ctl_start() {
-  xTaskCreate(check_pwr_task, "ctlTask", 1024, NULL, 1, NULL);
+uint8_t ctl_get_events(uint32_t* cursor, TEvent* events, size_t* n) {
+  size_t max       = *n;
+  bool   is_resync = false;
+
+  *n = 0;
+
+  while (*n < max) {
+    uint32_t head = event_sequence;
+
+    if (head - *cursor > EVENT_RING_SIZE || *cursor > head) {
+      // Start again from the last event - Any event read so far is dropped
+      *cursor   = head > 0 ? head - 1 : 0;
+      *n        = 0;
+      is_resync = true;
+
+      continue;
+    }
+
+    if (*cursor == head) {
+      break;
+    }
+
+    events[*n] = event_ring[*cursor % EVENT_RING_SIZE];
+
+    // The event may have been overwritten while it was copied, which is handled
+    // as a resync on the next iteration
+    if (event_sequence - *cursor > EVENT_RING_SIZE) {
+      continue;
+    }
+
+    (*cursor)++;
+    (*n)++;
+  }
+
+  return is_resync ? E_OVERRUN : *n > 0 ? E_OK : E_NONE;
 }
 
-int32_t ctl_add_listener(const ctl_listener_t listener_fn) {
-  TEvent event;
+int32_t ctl_reset() {
+  if (IS_POWERED(controller_status)) {
+    cancel_actions();
+  }
 
-  portENTER_CRITICAL();
+  return queue_simple_action(A_RESET);
+}
 
-  if (n_listeners == MAX_LISTENERS) {
-    return -1;
+int32_t ctl_move_pickup_to_initial_position() {
+  return queue_simple_action(A_MOVE_PICKUP_TO_INITIAL_POSITION);
+}
+
+int32_t ctl_move_pickup_to_initial_position_then_move_it_back() {
+  return queue_simple_action(A_MOVE_PICKUP_TO_INITIAL_POSITION_THEN_MOVE_IT_BACK);
+}
+
+int32_t ctl_run_test_coils_and_motors() {
+  return queue_simple_action(A_RUN_TEST_COILS_AND_MOTORS);
+}
+
+int32_t ctl_play() {
+  return queue_simple_action(A_PLAY);
+}
+
+int32_t ctl_stop() {
+  if (IS_POWERED(controller_status)) {
+    cancel_actions();
   }
 
-  listeners[n_listeners++] = listener_fn;
+  return queue_simple_action(A_STOP);
+}
+
+int32_t ctl_tune_tracking() {
+  return queue_simple_action(A_TUNE_TRACKING);
+}
+
+int32_t ctl_run_user_script() {
+  return queue_simple_action(A_RUN_USER_SCRIPT);
+}
+
+int32_t ctl_calibrate_tracking() {
+  return queue_simple_action(A_CALIBRATE_TRACKING);
+}
+
+void ctl_get_tracking_calibration(TTrackingCalibration* calibration) {
+  portENTER_CRITICAL();
+
+  *calibration = tracking_calibration;
+
+  portEXIT_CRITICAL();
+}
+
+int32_t ctl_seek(const TSeekTarget* target) {
+  TRequest request = {
+    .action = A_SEEK,
+    .target = *target
+  };
+
+  return queue_action(&request);
+}
+
+int32_t ctl_seek_next_track() {
+  TRequest request = {
+    .action = A_SEEK,
+    .target = { .track = SEEK_NEXT_TRACK }
+  };
 
-  event.is_busy     = IS_BUSY    (controller_status);
-  event.is_powered  = IS_POWERED (controller_status);
-  event.status_text = STATUS_TEXT(controller_status);
+  return queue_action(&request);
+}
+
+void ctl_get_seek_result(TSeekResult* result) {
+  portENTER_CRITICAL();
+
+  *result = seek_result;
 
   portEXIT_CRITICAL();
+}
 
-  listener_fn(&event);
+int32_t ctl_scan(uint16_t spacing_s, uint16_t dwell_ms) {
+  TRequest request = {
+    .action    = A_SCAN,
+    .spacing_s = spacing_s,
+    .dwell_ms  = dwell_ms
+  };
 
-  return 0;
+  return queue_action(&request);
 }
 
-void ctl_reset() {
-  RUN_TASK(reset);
+void ctl_get_scan_info(TScanInfo* info) {
+  portENTER_CRITICAL();
+
+  *info = scan_info;
+
+  portEXIT_CRITICAL();
 }
 
-void ctl_move_pickup_to_initial_position() {
-  RUN_TASK(move_pickup_to_initial_position);
+bool ctl_get_scan_point(size_t i, TScanPoint* point) {
+  if (i >= scan_info.n_points) {
+    return false;
+  }
+
+  *point = scan_points[i];
+
+  return true;
 }
 
-void ctl_move_pickup_to_initial_position_then_move_it_back() {
-  RUN_TASK(move_pickup_to_initial_position_then_move_it_back);
+void ctl_get_recovery_stats(TRecoveryStats* stats) {
+  portENTER_CRITICAL();
+
+  *stats = recovery_stats;
+
+  portEXIT_CRITICAL();
 }
 
-void ctl_run_test_coils_and_motors() {
-  RUN_TASK(run_test_coils_and_motors);
+void ctl_get_timing_stats(TTimingStats* stats) {
+  portENTER_CRITICAL();
+
+  *stats = timing_stats;
+
+  portEXIT_CRITICAL();
 }
 
-void ctl_play() {
-  RUN_TASK(play);
+int32_t ctl_run_micom_commands(
+  size_t               n,
+  uint16_t*            commands,
+  ctl_micom_listener_t listener_fn
+) {
+  int32_t  result;
+  TRequest request = {
+    .action      = A_RUN_MICOM_COMMANDS,
+    .n           = n,
+    .commands    = commands,
+    .listener_fn = listener_fn
+  };
+
+  if ((result = queue_action(&request)) != CTL_OK) {
+    free(commands);
+  }
+
+  return result;
 }
 
-void ctl_stop() {
-  RUN_TASK(stop);
+int32_t ctl_replay(uint16_t speed_pct) {
+  int32_t  result;
+  TRequest request = {
+    .action    = A_REPLAY,
+    .speed_pct = speed_pct == 0 ? 100 : speed_pct
+  };
+
+  // Only one session can be replayed at a time
+  if (is_replay_open) {
+    return CTL_QUEUE_FULL;
+  }
+
+  xQueueReset(replay_queue);
+
+  is_replay_open = true;
+
+  if ((result = queue_action(&request)) != CTL_OK) {
+    is_replay_open = false;
+  }
+
+  return result;
 }
 
-void ctl_tune_tracking() {
-  RUN_TASK(tune_tracking);
+int32_t ctl_replay_text(uint16_t speed_pct, char* text) {
+  int32_t  result;
+  TRequest request = {
+    .action    = A_REPLAY,
+    .speed_pct = speed_pct == 0 ? 100 : speed_pct,
+    .text      = text
+  };
+
+  if ((result = queue_action(&request)) != CTL_OK) {
+    free(text);
+  }
+
+  return result;
 }
 
-void ctl_run_micom_commands(size_t n, uint16_t* commands) {
-  if (try_lock()) {
-    micom_task_n        = n;
-    micom_task_commands = commands;
+int32_t ctl_replay_write(const TReplayCommand* command) {
+  TickType_t start = xTaskGetTickCount();
 
-    xTaskCreate(run_micom_commands, "ctlAction", 1024, NULL, 1, NULL);
+  // The replay may be cancelled while waiting for room so keep checking
+  while (is_replay_open) {
+    if (xQueueSendToBack(replay_queue, command, 100 / portTICK_RATE_MS) == pdTRUE) {
+      return CTL_OK;
+    }
+
+    if (xTaskGetTickCount() - start >= REPLAY_TIMEOUT_MS / portTICK_RATE_MS) {
+      break;
+    }
   }
+
+  return CTL_NOT_RUNNING;
+}
+
+int32_t ctl_replay_end() {
+  TReplayCommand command = { .bits = REPLAY_END_BITS };
+
+  return ctl_replay_write(&command);
 }
@@ -1,43 +1,221 @@
 #pragma once
 
+#include "replay.h"
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+// Status of the controller - The values are part of the script interface so new
+// values must be added at the end
+enum kControllerStatus {
+  S_WAIT_FOR_POWER = 0,
+  S_IDLE,
+  S_ERROR_TIMED_OUT,
+  S_UNEXPECTED_ERROR,
+  S_NO_DISC,
+  S_PLAYING,
+  S_PAUSED,
+  S_RESET_IN_PROGRESS,
+  S_PICKUP_TO_INITIAL_POSITION,
+  S_PICKUP_MOVE_BACKWARDS,
+  S_TESTING_TRACKING_COIL,
+  S_TESTING_SLED_MOTOR,
+  S_TESTING_FOCUS_COIL,
+  S_TESTING_SPINDLE_MOTOR,
+  S_LOOKING_FOR_DISC,
+  S_RUNNING_MICOM_COMMANDS,
+  S_RUNNING_SCRIPT,
+  S_CALIBRATING_TRACKING,
+  S_SEEKING,
+  S_RECOVERING,
+  S_SCANNING,
+  S_REPLAYING,
+  S_COUNT
+};
+
 typedef struct {
+  uint32_t    sequence;     // Sequence number - Consecutive events have consecutive numbers
   bool        is_busy;      // Indicates if the controller is busy
   bool        is_powered;   // Indicates if the controller is powered
   const char* status_text;  // Friendly description of the current status
 } TEvent;
 
-// Signature of the callback function to call on an event
-typedef void (*ctl_listener_t)(const TEvent*);
+// Surface scan - Defaults and limits
+#define SCAN_DEFAULT_SPACING_S  30
+#define SCAN_DEFAULT_DWELL_MS   500
+#define SCAN_MAX_POINTS         160
+
+// Result codes of the API reading events
+enum kEventResult {
+  E_OK = 0,   // An event has been read
+  E_NONE,     // There were no new events before the timeout expired
+  E_OVERRUN,  // Some events were overwritten before being read - The next read
+              // returns the oldest event available
+};
+
+// Result codes of the APIs running an action
+enum kControllerResult {
+  CTL_OK          =  0, // The action has been queued
+  CTL_QUEUE_FULL  = -1, // There are too many actions waiting to be run
+  CTL_NOT_POWERED = -2, // The controller board is not powered
+  CTL_NOT_RUNNING = -3, // The action the data is written to is not running
+};
+
+// Completion status of a MICOM command
+enum kMicomResult {
+  M_SENT = 0,   // The command does not signal its completion so it was just sent
+  M_COMPLETED,  // SENS went high after sending the command
+  M_TIMED_OUT,  // SENS did not go high before the timeout expired
+  M_CANCELLED,  // The command was not sent or waited on as the batch was cancelled
+};
+
+// Result of the last tracking calibration
+typedef struct {
+  bool        is_valid;     // Indicates if the calibration was completed
+  uint8_t     balance;      // Tracking balance - Sent as 0x800 | balance after 0x844
+  uint8_t     gain;         // Tracking gain    - Sent as 0x820 | gain after 0x848
+  uint32_t    elapsed_ms;   // Time taken by the calibration, homing included
+  uint32_t    n_probes;     // Number of balance and gain values tried
+} TTrackingCalibration;
+
+// Target of a seek - Either the start of a track or an absolute time
+typedef struct {
+  uint8_t     track;        // Track number - 0 to seek to the time below
+  uint8_t     min;          // Absolute time - Minutes
+  uint8_t     sec;          // Absolute time - Seconds
+  uint8_t     frame;        // Absolute time - Frames (1 / 75 S)
+} TSeekTarget;
+
+// Result of the last seek - All the times are given in frames (1 / 75 S)
+typedef struct {
+  bool        is_valid;     // Indicates if the target was reached
+  uint32_t    target;       // Absolute time of the target
+  uint32_t    reached;      // Absolute time where the seek finished
+  uint32_t    latency_ms;   // Time from the request until the target was played
+  uint32_t    n_iterations; // Number of moves of the correction loop
+} TSeekResult;
+
+// Steps for recovering the playback, from the lightest to the heaviest one
+enum kRecoveryStep {
+  RC_TRACKING = 0,  // Enable the tracking and sled servos again
+  RC_FOCUS,         // Look for focus again and then enable the servos
+  RC_SEEK,          // Start the disc again and seek to the last position played, if any
+  RC_COUNT
+};
+
+// Metrics of the recoveries of the playback - All the times are measured from
+// the moment the loss is noticed until the playback is restored
+typedef struct {
+  uint32_t    n_losses;               // Losses of the playback noticed
+  uint32_t    n_recovered[RC_COUNT];  // Losses recovered by each step
+  uint32_t    n_failed;               // Losses not recovered by any step
+  uint32_t    last_ms;                // Time taken by the last recovery
+  uint32_t    max_ms;                 // Time taken by the longest recovery
+  uint32_t    total_ms;               // Time taken by all the recoveries
+} TRecoveryStats;
+
+// Timing of the MICOM transmission - The latency of an action is measured from
+// the moment it is requested until its first MICOM command is queued, and a
+// burst lasts from its first command being queued until its last one is latched
+typedef struct {
+  uint32_t    n_requests;       // Actions that sent MICOM commands
+  uint32_t    last_request_us;  // Latency of the last action
+  uint32_t    max_request_us;   // Latency of the slowest action
+  uint32_t    total_request_us; // Latency of all the actions
+  uint32_t    n_bursts;         // Bursts of commands transmitted
+  uint32_t    n_commands;       // Commands transmitted in all the bursts
+  uint32_t    total_burst_us;   // Time taken by all the bursts
+  uint32_t    last_burst_commands;
+  uint32_t    last_burst_us;
+} TTimingStats;
+
+// A point of the surface scan - The quality of the reading is measured while
+// the disc is played for a while at the point
+typedef struct {
+  uint32_t    atime;        // Absolute time of the point, in frames (1 / 75 S)
+  bool        is_reached;   // Indicates if the point was reached - Otherwise,
+                            // the measurements below are meaningless
+  uint16_t    lock_ms;      // Time taken by the frame lock after the last move
+  uint16_t    n_frames;     // Frames signaled by SCOR while playing the point
+  uint16_t    crc_errors;   // Ratio of those frames failing the CRC check (per mille)
+  uint8_t     fok_dropouts; // Times FOK went low while playing the point
+} TScanPoint;
+
+// Summary of the last surface scan
+typedef struct {
+  bool        is_complete;  // Indicates if the scan reached the end of the disc
+  size_t      n_points;     // Number of points scanned so far
+  uint32_t    spacing;      // Distance between points, in frames (1 / 75 S)
+  uint32_t    elapsed_ms;   // Time taken by the scan
+} TScanInfo;
+
+// Signature of the callback function to call once a batch of MICOM commands has
+// been processed. The results contain one of kMicomResult for each command
+typedef void (*ctl_micom_listener_t)(size_t, const uint16_t*, const uint8_t*);
 
 /**
  * Initializes the controller.
  *
  * This API must be called before any other API. Otherwise, the behaviour is
  * undefined.
+ *
+ * The actions requested through the APIs below are queued and run one after
+ * another by a single task. The APIs never block; they return CTL_OK once the
+ * action has been queued or one of kControllerResult otherwise.
  */
 void ctl_start();
 
 /**
- * Registers a new listener.
+ * Registers a new subscriber to the events of the controller.
+ *
+ * The events are kept in a ring that the controller writes without waiting on
+ * the subscribers, so each subscriber reads them at its own pace from its own
+ * task. The first event read by a new subscriber is the current status.
+ *
+ * @returns the identifier of the subscriber, on success; -1, if no more
+ * subscribers can be registered.
+ */
+int32_t ctl_subscribe();
+
+/**
+ * Reads the next event of a subscriber.
+ *
+ * If there are no new events the calling task is blocked until an event is
+ * written or the timeout expires, whichever occurs first. A subscriber must be
+ * read from a single task at a time.
+ *
+ * @returns one of kEventResult.
+ */
+uint8_t ctl_read_event(int32_t subscriber, TEvent* event, uint32_t timeout_ms);
+
+/**
+ * Reads the events written after a cursor without waiting.
+ *
+ * The cursor holds the sequence number of the next event to read and is owned
+ * by the caller, so any number of readers, e.g. the clients of the HTTP status
+ * feed, can follow the events without registering as subscribers. Up to n
+ * events are read and n is updated with the number of events read.
  *
- * Once registered, the listener will be notified with the current status of the
- * controller.
+ * If the events after the cursor have been overwritten, or the cursor is ahead
+ * of the last event, e.g. as it was kept across a restart, the reader has to
+ * resync: the events are read from the last one, which holds the current status.
  *
- * @returns 0, on success; -1, if no more listeners can be registered.
+ * @returns E_OK, if events have been read; E_NONE, if there are no new events;
+ * E_OVERRUN, if the reader had to resync.
  */
-int32_t ctl_add_listener(const ctl_listener_t);
+uint8_t ctl_get_events(uint32_t* cursor, TEvent* events, size_t* n);
 
 /**
  * Resets the controller.
  *
  * This action stops all the servos and cancels any auto-sequence command. The
  * reset line is set low so the system is in RESET state.
+ *
+ * Any action being run is cancelled and the actions waiting to be run are
+ * dropped.
  */
-void ctl_reset();
+int32_t ctl_reset();
 
 /**
  * Moves the optical pickup to the initial position.
@@ -45,7 +223,7 @@ void ctl_reset();
  * Once the action is completed the reset line is set low so the system is in
  * RESET state.
  */
-void ctl_move_pickup_to_initial_position();
+int32_t ctl_move_pickup_to_initial_position();
 
 /**
  * Moves the optical pickup to the initial position and then moves it backwards
@@ -54,7 +232,7 @@ void ctl_move_pickup_to_initial_position();
  * Once the action is completed the reset line is set low so the system is in
  * RESET state.
  */
-void ctl_move_pickup_to_initial_position_then_move_it_back();
+int32_t ctl_move_pickup_to_initial_position_then_move_it_back();
 
 /**
  * Runs a few mechanical tests.
@@ -63,27 +241,38 @@ void ctl_move_pickup_to_initial_position_then_move_it_back();
  * motors. Once the action is completed the reset line is set low so the system
  * is in RESET state.
  */
-void ctl_run_test_coils_and_motors();
+int32_t ctl_run_test_coils_and_motors();
 
 /**
  * Plays a disc from the current optical pickup position.
  *
+ * The start-up sequence is given by the "play" script, which can be replaced
+ * without rebuilding the firmware. Please refer to script.h.
+ *
  * The user must use STOP or RESET to finish this action. Otherwise, the optical
  * pickup may be pushed against the chassis.
  *
  * This API can be used to pause the disc playing too. If the API is called when
  * a disc is being played it will pause the reproduction. To resume it, call
  * this API again.
+ *
+ * While the disc is being played FOK, GFS and the continuity of the absolute
+ * time of channel Q are watched. A loss of any of them is recovered by running
+ * the steps in kRecoveryStep until one of them restores the playback, starting
+ * from the lightest step that may fix the loss.
  */
-void ctl_play();
+int32_t ctl_play();
 
 /**
  * Stops playing a disc.
  *
  * This API will cancel the PLAY action and move the optical pickup to the
  * initial position.
+ *
+ * Any action being run is cancelled, leaving the controller in RESET state, and
+ * the actions waiting to be run are dropped.
  */
-void ctl_stop();
+int32_t ctl_stop();
 
 /**
  * Sets the environment for tuning the tracking balance and gain.
@@ -98,15 +287,154 @@ void ctl_stop();
  * Once the balance is set, the user should proceed with the gain following a
  * similar approach. Please refer to the data sheet for more information.
  */
-void ctl_tune_tracking();
+int32_t ctl_tune_tracking();
+
+/**
+ * Calibrates the tracking balance and gain.
+ *
+ * The environment is set as in TUNE TRACKING and then both windows are searched
+ * with a binary search driven by the level of SENS, stopping as soon as a value
+ * within the tolerance is found. Once the action is completed the reset line is
+ * set low so the system is in RESET state.
+ *
+ * The result can be retrieved with ctl_get_tracking_calibration.
+ */
+int32_t ctl_calibrate_tracking();
+
+/**
+ * Gets the result of the last tracking calibration.
+ */
+void ctl_get_tracking_calibration(TTrackingCalibration* calibration);
+
+/**
+ * Moves the optical pickup to the start of a track or to an absolute time and
+ * plays the disc from there.
+ *
+ * The disc is played first if it is not being played already. If the table of
+ * contents is not known the optical pickup is moved to the initial position
+ * first, so it is read from the lead-in.
+ *
+ * The pickup is moved with sled kicks while the target is far away and with
+ * counted track jumps once it is close, reading the absolute time of channel Q
+ * after every move until the target is within a couple of seconds. The rest is
+ * covered by playing the disc. The result can be retrieved with
+ * ctl_get_seek_result.
+ */
+int32_t ctl_seek(const TSeekTarget* target);
+
+/**
+ * Moves the optical pickup to the start of the track after the one being
+ * played, as the NEXT button does.
+ */
+int32_t ctl_seek_next_track();
+
+/**
+ * Gets the result of the last seek.
+ */
+void ctl_get_seek_result(TSeekResult* result);
+
+/**
+ * Gets the metrics of the recoveries of the playback since the start.
+ */
+void ctl_get_recovery_stats(TRecoveryStats* stats);
+
+/**
+ * Gets the timing of the MICOM transmission since the start.
+ */
+void ctl_get_timing_stats(TTimingStats* stats);
+
+/**
+ * Scans the surface of the disc.
+ *
+ * The program area is sampled at points separated by the given spacing, which
+ * is widened if the disc would need more than SCAN_MAX_POINTS points. The
+ * optical pickup is moved to each point as in a seek and then the disc is
+ * played for the given dwell time, measuring the time taken by the frame lock,
+ * the ratio of frames failing the CRC check and the drops of FOK.
+ *
+ * A value of 0 for any of the arguments selects its default value. The points
+ * can be retrieved with ctl_get_scan_point while the scan is running.
+ */
+int32_t ctl_scan(uint16_t spacing_s, uint16_t dwell_ms);
+
+/**
+ * Gets the summary of the last surface scan.
+ */
+void ctl_get_scan_info(TScanInfo* info);
+
+/**
+ * Gets a point of the last surface scan.
+ *
+ * @returns true, if the point has been scanned; false, otherwise.
+ */
+bool ctl_get_scan_point(size_t i, TScanPoint* point);
+
+/**
+ * Runs the user script.
+ *
+ * The script must have been uploaded previously. Please refer to script.h for
+ * more information.
+ */
+int32_t ctl_run_user_script();
 
 /**
  * Runs arbitrary MICOM commands.
  *
  * Because this API runs asynchronously the caller must not release the buffer.
  * Instead, this API will take care of release the buffer once all the commands
- * have been processed.
+ * have been processed or the action has been rejected.
+ *
+ * Commands that signal their completion through SENS, the auto-sequence and the
+ * auto adjust commands, are followed by a wait on SENS going high; any other
+ * command is followed by the next one immediately. The listener, if given, is
+ * called with the completion status of every command once all of them have
+ * been processed.
+ */
+int32_t ctl_run_micom_commands(
+  size_t               n,
+  uint16_t*            commands,
+  ctl_micom_listener_t listener_fn
+);
+
+/**
+ * Replays a captured session.
+ *
+ * The commands are written with ctl_replay_write as the session is parsed, so
+ * a session of any length can be replayed, and ctl_replay_end marks its end.
+ * The time captured between two commands is kept, scaled by the given speed in
+ * percent (0 selects 100); if it was not captured the commands are paced by
+ * their completion as in ctl_run_micom_commands. The replay is given up if no
+ * commands are written for a while.
+ *
+ * Only one session can be replayed at a time; CTL_QUEUE_FULL is returned while
+ * another one is open.
+ */
+int32_t ctl_replay(uint16_t speed_pct);
+
+/**
+ * Replays a captured session held in memory.
+ *
+ * The session is given as a null-terminated text, which must have been checked
+ * with rpl_parse and must be allocated with malloc; it is freed by the
+ * controller once the replay finishes. The text is parsed by the action, so the
+ * call returns at once. The speed is given as in ctl_replay.
+ */
+int32_t ctl_replay_text(uint16_t speed_pct, char* text);
+
+/**
+ * Writes the next command of the session being replayed.
+ *
+ * The calling task is blocked while the replay falls behind, so the session is
+ * written at the pace it is replayed.
+ *
+ * @returns CTL_OK, on success; CTL_NOT_RUNNING, if the replay has finished, has
+ * been cancelled or does not take the command for a while.
+ */
+int32_t ctl_replay_write(const TReplayCommand* command);
+
+/**
+ * Marks the end of the session being replayed.
  *
- * A default delay is added between commands.
+ * @returns the same as ctl_replay_write.
  */
-void ctl_run_micom_commands(size_t n, uint16_t* commands);
+int32_t ctl_replay_end();
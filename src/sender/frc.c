@@ -0,0 +1,162 @@
+#include "frc.h"
+#include "common.h"
+
+// ESP8266
+#include "rom/ets_sys.h"
+#include "esp8266/timer_struct.h"
+#include "driver/hw_timer.h"
+
+// ESP SDK
+#include "esp_attr.h"
+#include "driver/soc.h"
+
+// FreeRTOS
+#include "FreeRTOS.h"
+
+// C
+#include <stdbool.h>
+
+// Minimum delay loaded in the hardware timer - Deadlines closer than this are
+// handled as if they had already expired
+#define MIN_DELAY_US    5
+
+// Maximum delay the hardware timer can be loaded with - The counter is 23 bits
+// wide and it runs at 5 MHz, so longer deadlines are reached in several steps
+#define MAX_DELAY_US    1000000
+
+#define US_TO_CYCLES(t) ((t) * CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ)
+
+// Identifiers of the timers - The generation makes the identifier of a timer
+// that has expired not to match the next timer using the same slot
+#define TIMER_ID(i, g)  ((int32_t) (((g) << 8) | (i)))
+#define TIMER_IDX(id)   ((id) & 0xFF)
+#define TIMER_GEN(id)   (((id) >> 8) & 0xFFFF)
+
+typedef struct {
+  bool            is_active;
+  uint16_t        generation;
+  uint32_t        deadline;     // CPU cycle count at which the timer expires
+  frc_callback_t  callback_fn;
+  void*           arg;
+} TTimer;
+
+static DRAM_ATTR TTimer timers[FRC_MAX_TIMERS];
+
+// Loads the hardware timer with the nearest deadline, if any - Must be called
+// with the interrupts disabled
+static void IRAM_ATTR schedule(uint32_t now) {
+  int32_t nearest = MAX_DELAY_US;
+  bool    found   = false;
+
+  for (size_t i = 0; i < FRC_MAX_TIMERS; i++) {
+    if (timers[i].is_active) {
+      int32_t remaining = (int32_t) (timers[i].deadline - now) / CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ;
+
+      if (remaining < nearest) {
+        nearest = remaining;
+      }
+
+      found = true;
+    }
+  }
+
+  frc1.ctrl.en = 0;
+
+  if (found) {
+    frc1.load.data = US_TO_TICKS(nearest < MIN_DELAY_US ? MIN_DELAY_US : nearest);
+    frc1.ctrl.en   = 1;
+  }
+}
+
+static void IRAM_ATTR frc_timer_isr_cb() {
+  uint32_t now = soc_get_ccount();
+
+  for (size_t i = 0; i < FRC_MAX_TIMERS; i++) {
+    TTimer* timer = &timers[i];
+
+    if (!timer->is_active || (int32_t) (timer->deadline - now) > US_TO_CYCLES(MIN_DELAY_US)) {
+      continue;
+    }
+
+    uint32_t delay_us = timer->callback_fn(timer->arg);
+
+    if (delay_us > FRC_MAX_DELAY_US) {
+      delay_us = FRC_MAX_DELAY_US;
+    }
+
+    if (delay_us == 0) {
+      timer->is_active = false;
+    } else {
+      // Keep the period regardless of the interrupt latency
+      timer->deadline += US_TO_CYCLES(delay_us);
+    }
+  }
+
+  schedule(soc_get_ccount());
+}
+
+void frc_start() {
+  portENTER_CRITICAL();
+
+  /* The callback for the timer is required as the handler will enter into an
+   * infinite loop if the interrupt is not cleared
+   */
+  _xt_isr_unmask(1 << ETS_FRC_TIMER1_INUM);
+  _xt_isr_attach(ETS_FRC_TIMER1_INUM, frc_timer_isr_cb, 0);
+
+  TM1_EDGE_INT_ENABLE();
+
+  frc1.ctrl.div       = TIMER_CLKDIV_16;
+  frc1.ctrl.intr_type = TIMER_EDGE_INT;
+  frc1.ctrl.reload    = 0;
+  frc1.ctrl.en        = 0;
+
+  portEXIT_CRITICAL();
+}
+
+int32_t frc_add(uint32_t delay_us, frc_callback_t callback_fn, void* arg) {
+  int32_t id = -1;
+
+  if (delay_us > FRC_MAX_DELAY_US) {
+    return -1;
+  }
+
+  portENTER_CRITICAL();
+
+  for (size_t i = 0; i < FRC_MAX_TIMERS; i++) {
+    if (!timers[i].is_active) {
+      uint32_t now = soc_get_ccount();
+
+      timers[i].deadline    = now + US_TO_CYCLES(delay_us);
+      timers[i].callback_fn = callback_fn;
+      timers[i].arg         = arg;
+      timers[i].is_active   = true;
+      timers[i].generation++;
+
+      schedule(now);
+
+      id = TIMER_ID(i, timers[i].generation);
+      break;
+    }
+  }
+
+  portEXIT_CRITICAL();
+
+  return id;
+}
+
+void frc_cancel(int32_t timer) {
+  if (timer < 0 || TIMER_IDX(timer) >= FRC_MAX_TIMERS) {
+    return;
+  }
+
+  portENTER_CRITICAL();
+
+  if (timers[TIMER_IDX(timer)].generation == TIMER_GEN(timer)) {
+    timers[TIMER_IDX(timer)].is_active = false;
+
+    schedule(soc_get_ccount());
+  }
+
+  portEXIT_CRITICAL();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+// Maximum number of timers running at once
+#define FRC_MAX_TIMERS  16
+
+// Maximum delay of a timer - The deadlines are kept as CPU cycle counts, which
+// wrap around every 26 S at 160 MHz
+#define FRC_MAX_DELAY_US 10000000
+
+// Signature of the callback function to call once a timer expires. It is called
+// from the interrupt handler so it must be placed in IRAM and return quickly.
+// The returned value is the delay in uS until the next call; 0 stops the timer
+typedef uint32_t (*frc_callback_t)(void*);
+
+/**
+ * Takes over the FRC1 timer and starts the timer service.
+ *
+ * The hardware timer is loaded with the nearest deadline of the timers running
+ * so any number of timers, up to FRC_MAX_TIMERS, can run at once.
+ */
+void frc_start();
+
+/**
+ * Starts a new timer.
+ *
+ * This API must not be called from an interrupt handler; a timer can be kept
+ * running by returning the next delay from its callback instead.
+ *
+ * @returns the identifier of the timer, on success; -1, if there are too many
+ * timers running.
+ */
+int32_t frc_add(uint32_t delay_us, frc_callback_t callback_fn, void* arg);
+
+/**
+ * Stops a timer.
+ *
+ * Once this API returns the callback of the timer will not be called again. It
+ * is safe to stop a timer that has already expired.
+ */
+void frc_cancel(int32_t timer);
@@ -0,0 +1,65 @@
+#include "idle.h"
+
+// ESP SDK
+#include "esp_attr.h"
+#include "esp_freertos_hooks.h"
+#include "esp_log.h"
+#include "driver/soc.h"
+
+// FreeRTOS
+#include "FreeRTOS.h"
+#include "freertos/timers.h"
+
+// Period of the idle percentage measurement
+#define WINDOW_MS 1000
+
+#define MS_TO_CYCLES(t) ((t) * 1000 * CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ)
+
+static const char*        module_id    = "idle";
+
+static TimerHandle_t      timer        = NULL;
+
+static volatile uint32_t  idle_cycles  = 0;   // Cycles spent halted - Only written by the idle task
+static uint32_t           last_cycles  = 0;   // Value of the above at the start of the window
+static volatile uint32_t  idle_percent = 0;   // Idle percentage of the last window
+
+static bool IRAM_ATTR idle_hook() {
+  uint32_t start = soc_get_ccount();
+
+  // Halt the CPU until the next interrupt - The RTOS tick wakes it up at least
+  // once per tick
+  __asm__ __volatile__ ("waiti 0");
+
+  idle_cycles += soc_get_ccount() - start;
+
+  // The CPU has already been halted, and the time accounted, so the idle task
+  // must not halt it again
+  return false;
+}
+
+static void measure(TimerHandle_t t) {
+  uint32_t cycles = idle_cycles;
+
+  idle_percent = (cycles - last_cycles) / (MS_TO_CYCLES(WINDOW_MS) / 100);
+  last_cycles  = cycles;
+
+  if (idle_percent > 100) {
+    idle_percent = 100;
+  }
+}
+
+void idle_start() {
+  if (esp_register_freertos_idle_hook(idle_hook) != ESP_OK) {
+    ESP_LOGE(module_id, "Failed to register the idle hook");
+
+    return;
+  }
+
+  timer = xTimerCreate("idleTimer", WINDOW_MS / portTICK_RATE_MS, pdTRUE, NULL, measure);
+
+  xTimerStart(timer, portMAX_DELAY);
+}
+
+uint32_t idle_get_percent() {
+  return idle_percent;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Starts accounting the time the CPU is idle.
+ *
+ * The idle task halts the CPU until the next interrupt instead of spinning, and
+ * the time spent halted is accounted so the CPU idle percentage can be used as
+ * a proxy of the current drawn by the MCU.
+ */
+void idle_start();
+
+/**
+ * Returns the percentage of time the CPU was idle during the last second.
+ */
+uint32_t idle_get_percent();
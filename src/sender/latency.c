@@ -0,0 +1,164 @@
+#include "latency.h"
+#include "micom.h"
+
+// FreeRTOS
+#include "FreeRTOS.h"
+
+// C
+#include <stdio.h>
+#include <string.h>
+
+// The times are kept in a histogram with 4 buckets per power of 2 from 16 uS to
+// 16 S, so an entry only needs a few hundred bytes whatever the count is
+#define MIN_SHIFT           4
+#define SUB_BUCKETS         4
+#define N_BUCKETS           ((24 - MIN_SHIFT) * SUB_BUCKETS)
+
+typedef struct {
+  uint16_t    command;
+  uint8_t     line;
+  uint32_t    count;
+  uint32_t    min;
+  uint32_t    max;
+  uint16_t    buckets[N_BUCKETS];
+} TEntry;
+
+static const char* line_text[] = {
+  "SENS",
+  "FOK",
+};
+
+static TEntry      entries[LAT_MAX_ENTRIES];
+static size_t      n_entries = 0;
+
+static size_t bucket_of(uint32_t us) {
+  uint32_t e;
+
+  if (us < (1 << MIN_SHIFT)) {
+    return 0;
+  }
+
+  e = 31 - __builtin_clz(us);
+
+  if (e >= MIN_SHIFT + N_BUCKETS / SUB_BUCKETS) {
+    return N_BUCKETS - 1;
+  }
+
+  // The two bits after the leading one select the bucket within the power of 2
+  return (e - MIN_SHIFT) * SUB_BUCKETS + ((us >> (e - 2)) & (SUB_BUCKETS - 1));
+}
+
+// Returns the middle of a bucket
+static uint32_t middle_of(size_t bucket) {
+  uint32_t e   = bucket / SUB_BUCKETS + MIN_SHIFT;
+  uint32_t sub = bucket % SUB_BUCKETS;
+
+  return ((SUB_BUCKETS + sub) << (e - 2)) + (1 << (e - 3));
+}
+
+// Returns the given percentile of an entry, within the range of times recorded
+static uint32_t percentile_of(const TEntry* entry, uint32_t pct) {
+  uint32_t rank = (entry->count * pct + 99) / 100;
+  uint32_t seen = 0;
+
+  for (size_t i = 0; i < N_BUCKETS; i++) {
+    if ((seen += entry->buckets[i]) >= rank) {
+      uint32_t middle = middle_of(i);
+
+      return middle < entry->min ? entry->min : middle > entry->max ? entry->max : middle;
+    }
+  }
+
+  return entry->max;
+}
+
+void lat_record(uint16_t command, uint8_t line, uint32_t us) {
+  TEntry* entry = NULL;
+  size_t  i;
+
+  portENTER_CRITICAL();
+
+  for (i = 0; i < n_entries && entry == NULL; i++) {
+    if (entries[i].command == command && entries[i].line == line) {
+      entry = &entries[i];
+    }
+  }
+
+  if (entry == NULL && n_entries < LAT_MAX_ENTRIES) {
+    entry = &entries[n_entries++];
+
+    memset(entry, 0, sizeof(TEntry));
+
+    entry->command = command;
+    entry->line    = line;
+    entry->min     = UINT32_MAX;
+  }
+
+  if (entry != NULL) {
+    i = bucket_of(us);
+
+    entry->count++;
+    entry->min = us < entry->min ? us : entry->min;
+    entry->max = us > entry->max ? us : entry->max;
+
+    // The bucket saturates rather than wrap around, which skews the percentiles
+    // only after 65535 times in the same bucket
+    if (entry->buckets[i] < UINT16_MAX) {
+      entry->buckets[i]++;
+    }
+  }
+
+  portEXIT_CRITICAL();
+}
+
+bool lat_get(size_t i, TLatency* latency) {
+  bool is_found;
+
+  portENTER_CRITICAL();
+
+  if ((is_found = i < n_entries)) {
+    const TEntry* entry = &entries[i];
+
+    latency->command = entry->command;
+    latency->line    = entry->line;
+    latency->count   = entry->count;
+    latency->min     = entry->min;
+    latency->p50     = percentile_of(entry, 50);
+    latency->p99     = percentile_of(entry, 99);
+    latency->max     = entry->max;
+  }
+
+  portEXIT_CRITICAL();
+
+  return is_found;
+}
+
+void lat_reset() {
+  portENTER_CRITICAL();
+
+  n_entries = 0;
+
+  portEXIT_CRITICAL();
+}
+
+void lat_print() {
+  TLatency             latency;
+  const TMicomCommand* group;
+
+  printf("Command  Group          Line      Count      Min      p50      p99      Max (uS)\n");
+
+  for (size_t i = 0; lat_get(i, &latency); i++) {
+    group = micom_decode(latency.command, micom_bits(latency.command));
+
+    printf("%04x     %-14s %-4s %10u %8u %8u %8u %8u\n",
+      latency.command,
+      group != NULL ? group->mnemonic : "-",
+      line_text[latency.line],
+      latency.count,
+      latency.min,
+      latency.p50,
+      latency.p99,
+      latency.max
+    );
+  }
+}
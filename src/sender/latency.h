@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of commands profiled - Further commands are not recorded
+#define LAT_MAX_ENTRIES     16
+
+// Lines the ICs signal the completion of a command on
+enum kLatencyLine {
+  LAT_SENS = 0,
+  LAT_FOK,
+  LAT_COUNT
+};
+
+// Completion times of a MICOM command, measured from the latch signal (XLT)
+// until the rising edge of the line - All the times are given in uS and the
+// percentiles are accurate to about 1/8
+typedef struct {
+  uint16_t    command;
+  uint8_t     line;     // One of kLatencyLine
+  uint32_t    count;
+  uint32_t    min;
+  uint32_t    p50;
+  uint32_t    p99;
+  uint32_t    max;
+} TLatency;
+
+/**
+ * Records the completion time of a command.
+ *
+ * This API must not be called from an interrupt handler.
+ */
+void lat_record(uint16_t command, uint8_t line, uint32_t us);
+
+/**
+ * Gets the completion times of a command, in the order they were first
+ * recorded.
+ *
+ * @returns true, if there is an entry with the given index; false, otherwise.
+ */
+bool lat_get(size_t i, TLatency* latency);
+
+/**
+ * Forgets all the completion times recorded.
+ */
+void lat_reset();
+
+/**
+ * Prints the completion times recorded to the standard output.
+ */
+void lat_print();
@@ -0,0 +1,193 @@
+#include "profile.h"
+
+// ESP SDK
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+// FreeRTOS
+#include "FreeRTOS.h"
+
+// C
+#include <string.h>
+
+#define NVS_NAMESPACE   "profile"
+#define NVS_KEY_PROFILE "profile"
+
+// Version of the stored profile - Increase it when TProfile changes so profiles
+// stored by previous versions are discarded
+#define PROFILE_VERSION 1
+
+// Maximum homing time accepted
+#define MAX_HOMING_MS   5000
+
+// Margin added to the homing time of the profile before a homing is slow
+#define HOMING_MARGIN_MS 1000
+
+// Values used by the firmware before the profile was introduced
+#define DEFAULT_PROFILE { \
+  .focus_bias = { 0x878, 0x87f }, \
+  .balance    = 0x0b, \
+  .gain       = 0x07, \
+  .homing_ms  = 0 \
+}
+
+typedef struct {
+  uint16_t    version;
+  TProfile    profile;
+  uint32_t    checksum; // FNV-1a of the fields above
+} TStoredProfile;
+
+static const char*     module_id       = "profile";
+
+static const TProfile  default_profile = DEFAULT_PROFILE;
+static TProfile        profile         = DEFAULT_PROFILE;
+static TProfileStats   stats;
+
+static uint32_t checksum(const TStoredProfile* stored) {
+  const uint8_t* data = (const uint8_t*) stored;
+  uint32_t       hash = 2166136261;
+
+  for (size_t i = 0; i < offsetof(TStoredProfile, checksum); i++) {
+    hash = (hash ^ data[i]) * 16777619;
+  }
+
+  return hash;
+}
+
+bool profile_validate(const TProfile* p) {
+  return (p->focus_bias[0] & 0xFFF0) == 0x870 &&
+         (p->focus_bias[1] & 0xFFF0) == 0x870 &&
+         p->balance   <= 0x1F                &&
+         p->gain      <= 0x1F                &&
+         p->homing_ms <= MAX_HOMING_MS;
+}
+
+bool profile_load() {
+  nvs_handle     handle;
+  TStoredProfile stored;
+  size_t         size  = sizeof(TStoredProfile);
+  bool           found = false;
+
+  profile = default_profile;
+
+  if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+    if (
+      nvs_get_blob(handle, NVS_KEY_PROFILE, &stored, &size) == ESP_OK &&
+      size            == sizeof(TStoredProfile)                      &&
+      stored.version  == PROFILE_VERSION                             &&
+      stored.checksum == checksum(&stored)                           &&
+      profile_validate(&stored.profile)
+    ) {
+      portENTER_CRITICAL();
+
+      profile = stored.profile;
+
+      portEXIT_CRITICAL();
+
+      found = true;
+    }
+
+    nvs_close(handle);
+  }
+
+  stats.is_loaded = found;
+
+  return found;
+}
+
+void profile_get(TProfile* p) {
+  portENTER_CRITICAL();
+
+  *p = profile;
+
+  portEXIT_CRITICAL();
+}
+
+int32_t profile_store(const TProfile* p) {
+  nvs_handle     handle;
+  TStoredProfile stored;
+  esp_err_t      status;
+
+  if (p != NULL && !profile_validate(p)) {
+    return -1;
+  }
+
+  if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+    return -1;
+  }
+
+  if (p == NULL) {
+    status = nvs_erase_key(handle, NVS_KEY_PROFILE);
+    status = status == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : status;
+  } else {
+    // Clear the padding as it is covered by the checksum
+    memset(&stored, 0, sizeof(TStoredProfile));
+
+    stored.version  = PROFILE_VERSION;
+    stored.profile  = *p;
+    stored.checksum = checksum(&stored);
+
+    status = nvs_set_blob(handle, NVS_KEY_PROFILE, &stored, sizeof(TStoredProfile));
+  }
+
+  if (status == ESP_OK) {
+    status = nvs_commit(handle);
+  }
+
+  nvs_close(handle);
+
+  if (status != ESP_OK) {
+    return -1;
+  }
+
+  portENTER_CRITICAL();
+
+  profile = p != NULL ? *p : default_profile;
+
+  portEXIT_CRITICAL();
+
+  return 0;
+}
+
+uint16_t IRAM_ATTR profile_command(uint8_t command) {
+  switch (command) {
+  case PC_FOCUS_BIAS_1:
+    return profile.focus_bias[0];
+
+  case PC_FOCUS_BIAS_2:
+    return profile.focus_bias[1];
+
+  case PC_BALANCE:
+    return 0x800 | profile.balance;
+
+  case PC_GAIN:
+    return 0x820 | profile.gain;
+  }
+
+  return 0;
+}
+
+void profile_update_homing(uint16_t ms) {
+  portENTER_CRITICAL();
+
+  if (profile.homing_ms > 0 && ms > profile.homing_ms * 2 + HOMING_MARGIN_MS) {
+    stats.n_slow_homings++;
+  }
+
+  if (ms > profile.homing_ms && ms <= MAX_HOMING_MS) {
+    profile.homing_ms = ms;
+  }
+
+  stats.last_homing_ms = ms;
+
+  portEXIT_CRITICAL();
+}
+
+void profile_get_stats(TProfileStats* s) {
+  portENTER_CRITICAL();
+
+  *s = stats;
+
+  portEXIT_CRITICAL();
+}
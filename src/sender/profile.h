@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Calibration profile of the mechanism - Every unit differs slightly so the
+// values found once are kept in the flash memory and applied on every start-up
+typedef struct {
+  uint16_t    focus_bias[2];  // Focus error bias commands - 0x870 ~ 0x87f
+  uint8_t     balance;        // Tracking balance - Sent as 0x800 | balance after 0x844
+  uint8_t     gain;           // Tracking gain    - Sent as 0x820 | gain after 0x848
+  uint16_t    homing_ms;      // Longest time measured for homing the optical pickup; 0 if unknown
+} TProfile;
+
+// How the profile in use came to be and the homings measured since the start
+typedef struct {
+  bool        is_loaded;      // The stored profile was loaded - The default one is used otherwise
+  uint16_t    last_homing_ms; // Time of the last homing; 0 if none
+  uint32_t    n_slow_homings; // Homings much longer than the longest known
+} TProfileStats;
+
+// MICOM commands built from the profile - Argument of OP_SEND_PROFILE
+enum kProfileCommand {
+  PC_FOCUS_BIAS_1 = 0,
+  PC_FOCUS_BIAS_2,
+  PC_BALANCE,
+  PC_GAIN,
+  PC_COUNT
+};
+
+/**
+ * Loads the profile from the flash memory.
+ *
+ * The default profile is used if there is no profile stored, or if it was
+ * stored by a different version or its checksum does not match.
+ *
+ * @returns true, if the stored profile was loaded; false, otherwise.
+ */
+bool profile_load();
+
+/**
+ * Gets the profile in use.
+ */
+void profile_get(TProfile* profile);
+
+/**
+ * Checks whether all the values of a profile are within range.
+ */
+bool profile_validate(const TProfile* profile);
+
+/**
+ * Sets the profile in use and stores it in the flash memory.
+ *
+ * If no profile is given the stored one is erased, so the default one is used
+ * from now on.
+ *
+ * @returns 0, on success; -1, if the profile is not valid or cannot be stored.
+ */
+int32_t profile_store(const TProfile* profile);
+
+/**
+ * Returns the MICOM command for one of kProfileCommand.
+ */
+uint16_t profile_command(uint8_t command);
+
+/**
+ * Updates the homing time in use, but not the stored one, if the given time is
+ * longer.
+ *
+ * A homing taking more than twice the longest time known, plus a margin, is
+ * counted as slow as the mechanism may be wearing out.
+ *
+ * The flash memory is not written on every homing; the time is stored with the
+ * rest of the profile by the next tracking calibration or POST.
+ */
+void profile_update_homing(uint16_t ms);
+
+/**
+ * Gets whether the stored profile was loaded and the homings measured.
+ */
+void profile_get_stats(TProfileStats* stats);
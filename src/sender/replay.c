@@ -0,0 +1,188 @@
+#include "replay.h"
+
+// C
+#include <ctype.h>
+
+// States of the parser
+enum kState {
+  P_SPACE = 0,  // Between tokens
+  P_COMMENT,    // Within a comment
+  P_DELAY,      // Within the time since the previous command
+  P_WORD,       // Within a command
+  P_DOT,        // After the first dot of a run
+  P_RUN,        // Within the last command of a run
+  P_BITS,       // Within the length of a command
+};
+
+static int32_t hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+
+  c = tolower((unsigned char) c);
+
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// Starts a new token
+static void start(TReplayParser* parser, uint8_t state) {
+  parser->state    = state;
+  parser->value    = 0;
+  parser->n_digits = 0;
+}
+
+// Completes the token being parsed
+static uint8_t complete(TReplayParser* parser, rpl_listener_t listener_fn, void* arg) {
+  TReplayCommand command;
+
+  switch (parser->state) {
+  case P_DELAY:
+    if (parser->n_digits == 0) {
+      return RPL_SYNTAX_ERROR;
+    }
+
+    parser->delay_us += parser->value;
+    break;
+
+  case P_WORD:
+  case P_RUN:
+  case P_BITS:
+    if (parser->n_digits == 0) {
+      return RPL_SYNTAX_ERROR;
+    }
+
+    // Both ends of a run are the same command
+    if (parser->state == P_RUN && parser->value != parser->command) {
+      return RPL_SYNTAX_ERROR;
+    }
+
+    command.command  = parser->state == P_WORD ? parser->value : parser->command;
+    command.bits     = parser->state == P_BITS ? parser->value : 0;
+    command.delay_us = parser->delay_us;
+
+    if (command.bits > RPL_MAX_BITS || (command.bits > 0 && command.command >> command.bits != 0)) {
+      return RPL_SYNTAX_ERROR;
+    }
+
+    parser->delay_us = 0;
+
+    if (!listener_fn(&command, arg)) {
+      return RPL_ABORTED;
+    }
+    break;
+
+  case P_DOT:
+    return RPL_SYNTAX_ERROR;
+  }
+
+  start(parser, P_SPACE);
+
+  return RPL_OK;
+}
+
+void rpl_init(TReplayParser* parser) {
+  start(parser, P_SPACE);
+
+  parser->delay_us = 0;
+  parser->command  = 0;
+  parser->line     = 1;
+}
+
+uint8_t rpl_parse(TReplayParser* parser, const char* data, size_t n, rpl_listener_t listener_fn, void* arg) {
+  uint8_t result;
+
+  for (size_t i = 0; i < n; i++) {
+    char    c     = data[i];
+    int32_t digit = hex_value(c);
+
+    if (c == '\n') {
+      parser->line++;
+    }
+
+    if (parser->state == P_COMMENT) {
+      if (c == '\n') {
+        start(parser, P_SPACE);
+      }
+
+      continue;
+    }
+
+    if (isspace((unsigned char) c) || c == '#') {
+      if ((result = complete(parser, listener_fn, arg)) != RPL_OK) {
+        return result;
+      }
+
+      if (c == '#') {
+        start(parser, P_COMMENT);
+      }
+
+      continue;
+    }
+
+    switch (parser->state) {
+    case P_SPACE:
+      if (c == '+') {
+        start(parser, P_DELAY);
+
+        continue;
+      }
+
+      start(parser, P_WORD);
+
+      // The first digit of the command is parsed below
+      break;
+
+    case P_WORD:
+      if (c == '.') {
+        parser->command = parser->value;
+        parser->state   = P_DOT;
+
+        continue;
+      }
+
+      if (c == '/') {
+        parser->command = parser->value;
+
+        start(parser, P_BITS);
+
+        continue;
+      }
+      break;
+
+    case P_DOT:
+      if (c != '.') {
+        return RPL_SYNTAX_ERROR;
+      }
+
+      start(parser, P_RUN);
+
+      continue;
+    }
+
+    if (parser->state == P_DELAY || parser->state == P_BITS) {
+      digit = c >= '0' && c <= '9' ? c - '0' : -1;
+    }
+
+    if (digit < 0) {
+      return RPL_SYNTAX_ERROR;
+    }
+
+    parser->value = parser->state == P_DELAY || parser->state == P_BITS
+                  ? parser->value * 10 + digit
+                  : parser->value * 16 + digit;
+
+    if (++parser->n_digits > 8 || (parser->state != P_DELAY && parser->value > 0xFFFF)) {
+      return RPL_SYNTAX_ERROR;
+    }
+  }
+
+  return RPL_OK;
+}
+
+uint8_t rpl_finish(TReplayParser* parser, rpl_listener_t listener_fn, void* arg) {
+  if (parser->state == P_COMMENT) {
+    return RPL_OK;
+  }
+
+  return complete(parser, listener_fn, arg);
+}
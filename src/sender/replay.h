@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A captured session is the text written by the sniffer: MICOM commands as hex
+// words separated by white space, each one followed by its length in bits if it
+// was captured with a length other than the one of the table, e.g. 008/12. The
+// text may also be annotated by hand, as the sessions in logs/*.txt: comments
+// start with # until the end of the line, a word may be preceded by the time
+// since the previous command in uS, e.g. +1500, and a run of the same command
+// may be written as 0017..0017, which is replayed as a single command as the
+// length of the run is unknown
+
+// Maximum length of a command in bits
+#define RPL_MAX_BITS        16
+
+// Result codes of the parser
+enum kReplayResult {
+  RPL_OK = 0,       // The text has been parsed
+  RPL_SYNTAX_ERROR, // The text is not a captured session
+  RPL_ABORTED,      // The listener stopped the parser
+};
+
+// A MICOM command of a captured session
+typedef struct {
+  uint16_t    command;
+  uint8_t     bits;     // Length in bits - 0 if not captured
+  uint32_t    delay_us; // Time since the previous command - 0 if not captured
+} TReplayCommand;
+
+// Signature of the function to call on every command parsed. The parser is
+// stopped if it returns false
+typedef bool (*rpl_listener_t)(const TReplayCommand*, void*);
+
+// State of the parser - Kept between chunks so a session is parsed as it is
+// received rather than loaded into memory
+typedef struct {
+  uint8_t     state;
+  uint32_t    value;    // Value of the token being parsed
+  size_t      n_digits; // Digits of the token being parsed
+  uint32_t    delay_us; // Time captured for the next command
+  uint16_t    command;  // Command being parsed, once the bits or the end of the
+                        // run are reached
+  size_t      line;     // Line being parsed, for reporting errors
+} TReplayParser;
+
+/**
+ * Initializes a parser.
+ */
+void rpl_init(TReplayParser* parser);
+
+/**
+ * Parses a chunk of a captured session.
+ *
+ * The listener is called on every command parsed as soon as the token ending
+ * it is found, so a command split between two chunks is reported once the
+ * second one is parsed.
+ *
+ * @returns one of kReplayResult.
+ */
+uint8_t rpl_parse(TReplayParser* parser, const char* data, size_t n, rpl_listener_t listener_fn, void* arg);
+
+/**
+ * Parses the end of a captured session, reporting the last command, if any.
+ *
+ * @returns one of kReplayResult.
+ */
+uint8_t rpl_finish(TReplayParser* parser, rpl_listener_t listener_fn, void* arg);
@@ -0,0 +1,163 @@
+#include "sampler.h"
+
+// ESP SDK
+#include "esp_attr.h"
+#include "esp_log.h"
+
+// FreeRTOS
+#include "FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+// Reads the voltage at ADC pin
+extern uint16_t test_tout();
+
+// Threshold values for ADC
+
+#define POWER_ON_STATUS_MIN 200
+#define POWER_ON_STATUS_MAX 800
+#define PICKUP_LIMIT_SW_MIN 350
+#define PICKUP_LIMIT_SW_MAX 500
+
+// Number of consecutive samples a state must be seen before it is published
+#define DEBOUNCE_SAMPLES    2
+
+// Maximum number of registered listeners allowed
+#define MAX_LISTENERS       2
+
+// Bits of the event group - Each state bit has its own bit for the clear level
+// as the event group can only wait for bits to be set
+#define SET_BITS(s)         ((s) & 0x03)
+#define CLEAR_BITS(s)       ((~(s) & 0x03) << 2)
+#define ALL_BITS            0x0F
+
+static const char*        module_id    = "sampler";
+
+static TimerHandle_t      timer        = NULL;
+static EventGroupHandle_t event_group  = NULL;
+
+static uint16_t           samples[3];           // The last samples - Median filter
+static uint8_t            n_samples    = 0;
+static uint8_t            sample_idx   = 0;
+static uint32_t           candidate    = 0;     // The state seen in the last samples
+static uint8_t            n_candidate  = 0;     // Consecutive samples the candidate has been seen
+
+static volatile uint32_t  state        = 0;
+static volatile uint16_t  value        = 0;
+
+static size_t             n_listeners  = 0;
+static smp_listener_t     listeners[MAX_LISTENERS];
+
+static uint16_t IRAM_ATTR median(uint16_t a, uint16_t b, uint16_t c) {
+  if (a > b) {
+    uint16_t t = a; a = b; b = t;
+  }
+
+  return c <= a ? a : c >= b ? b : c;
+}
+
+static uint32_t IRAM_ATTR classify(uint16_t v) {
+  uint32_t s = 0;
+
+  if (v >= POWER_ON_STATUS_MIN && v <= POWER_ON_STATUS_MAX) {
+    s |= SMP_POWERED;
+
+    if (v >= PICKUP_LIMIT_SW_MIN && v <= PICKUP_LIMIT_SW_MAX) {
+      s |= SMP_LIMIT_SWITCH;
+    }
+  }
+
+  return s;
+}
+
+static void IRAM_ATTR sample(TimerHandle_t t) {
+  uint16_t v;
+
+  // The ADC is shared with the RF calibration so it must be read with the
+  // scheduler suspended, which now only happens once per sample
+  vTaskSuspendAll();
+  v = test_tout();
+  xTaskResumeAll ();
+
+  // Use the median of the last three samples, which discards isolated glitches
+  // without producing intermediate values while the voltage changes
+  samples[sample_idx] = v;
+  sample_idx          = (sample_idx + 1) % 3;
+
+  if (n_samples < 3 && ++n_samples < 3) {
+    return;
+  }
+
+  value = median(samples[0], samples[1], samples[2]);
+
+  uint32_t s = classify(value);
+
+  if (s != candidate) {
+    candidate   = s;
+    n_candidate = 0;
+  }
+
+  if (++n_candidate < DEBOUNCE_SAMPLES || s == state) {
+    return;
+  }
+
+  state = s;
+
+  ESP_LOGD(module_id, "State = %u (ADC = %u)", s, value);
+
+  xEventGroupClearBits(event_group, ALL_BITS);
+  xEventGroupSetBits  (event_group, SET_BITS(s) | CLEAR_BITS(s));
+
+  for (size_t i = 0; i < n_listeners; i++) {
+    listeners[i](s, value);
+  }
+}
+
+void smp_start() {
+  event_group = xEventGroupCreate();
+
+  xEventGroupSetBits(event_group, SET_BITS(state) | CLEAR_BITS(state));
+
+  // The timer cannot run faster than the RTOS tick
+  timer = xTimerCreate("smpTimer", SMP_PERIOD_MS / portTICK_RATE_MS, pdTRUE, NULL, sample);
+
+  xTimerStart(timer, portMAX_DELAY);
+}
+
+void smp_set_idle(bool is_idle) {
+  xTimerChangePeriod(timer,
+    (is_idle ? SMP_IDLE_PERIOD_MS : SMP_PERIOD_MS) / portTICK_RATE_MS,
+    portMAX_DELAY
+  );
+}
+
+uint32_t smp_get_state() {
+  return state;
+}
+
+uint16_t smp_get_value() {
+  return value;
+}
+
+int32_t smp_add_listener(const smp_listener_t listener_fn) {
+  int32_t result = -1;
+
+  portENTER_CRITICAL();
+
+  if (n_listeners < MAX_LISTENERS) {
+    listeners[n_listeners++] = listener_fn;
+
+    result = 0;
+  }
+
+  portEXIT_CRITICAL();
+
+  return result;
+}
+
+bool smp_wait(uint32_t mask, uint32_t s, uint32_t timeout_ms) {
+  EventBits_t bits = (SET_BITS(s) | CLEAR_BITS(s)) & (SET_BITS(mask) | (SET_BITS(mask) << 2));
+
+  return (xEventGroupWaitBits(event_group, bits, pdFALSE, pdTRUE, timeout_ms / portTICK_RATE_MS) & bits) == bits;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// States published by the sampler - The ADC pin is wired to the controller
+// board so the voltage tells whether the board is powered and, while it is,
+// whether the limit switch of the optical pickup is pressed
+enum kSamplerState {
+  SMP_POWERED      = (1 << 0),  // The controller board is powered
+  SMP_LIMIT_SWITCH = (1 << 1),  // The optical pickup is at the initial position
+};
+
+// Sampling periods - A change of the state is published after the median of
+// the last three samples changes and then stays for another sample
+#define SMP_PERIOD_MS       10
+#define SMP_IDLE_PERIOD_MS  100
+#define SMP_IDLE_LATENCY_MS (4 * SMP_IDLE_PERIOD_MS)
+
+// Signature of the callback function to call when the state changes. The
+// arguments are the new state and the filtered ADC value
+typedef void (*smp_listener_t)(uint32_t, uint16_t);
+
+/**
+ * Starts sampling the ADC pin.
+ *
+ * The pin is sampled from a timer at a fixed rate, the readings are filtered
+ * and a state is published only once it has been seen in a few consecutive
+ * samples.
+ */
+void smp_start();
+
+/**
+ * Switches the sampling rate between the normal rate and the idle rate.
+ *
+ * The idle rate is meant for waiting for the controller board to be powered
+ * while saving power. Even at the idle rate a change of the state is published
+ * within SMP_IDLE_LATENCY_MS.
+ */
+void smp_set_idle(bool is_idle);
+
+/**
+ * Returns the current state as a combination of kSamplerState.
+ */
+uint32_t smp_get_state();
+
+/**
+ * Returns the last filtered ADC value.
+ */
+uint16_t smp_get_value();
+
+/**
+ * Registers a new listener.
+ *
+ * The listener is notified every time the state changes. Listeners are called
+ * from the timer task so they must return quickly and never block.
+ *
+ * @returns 0, on success; -1, if no more listeners can be registered.
+ */
+int32_t smp_add_listener(const smp_listener_t);
+
+/**
+ * Waits for the bits of the state in the mask to have the given values or the
+ * timeout to expire, whichever occurs first.
+ *
+ * @returns true, if the state was reached; false, if the timeout expired.
+ */
+bool smp_wait(uint32_t mask, uint32_t state, uint32_t timeout_ms);
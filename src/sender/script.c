@@ -0,0 +1,344 @@
+#include "script.h"
+#include "controller.h"
+#include "profile.h"
+
+// ESP SDK
+#include "nvs.h"
+
+// C
+#include <string.h>
+
+#define NVS_NAMESPACE "scripts"
+
+#define I(op, arg)    SCRIPT_OP(op, arg)
+
+typedef struct {
+  const char*     name;
+  const uint32_t* code;
+  size_t          n;
+} TScript;
+
+static const uint32_t play_script[] = {
+  /*  0 */ I(OP_MARK         , PH_RESET               ),
+  /*  1 */ I(OP_SET_XRST     , 0                      ),
+  /*  2 */ I(OP_SET_XRST     , 1                      ),
+  /*  3 */ I(OP_SET_STATUS   , S_LOOKING_FOR_DISC     ),
+
+  // Adjust focus error bias
+  /*  4 */ I(OP_MARK         , PH_FOCUS_BIAS          ),
+  /*  5 */ I(OP_SEND_PROFILE , PC_FOCUS_BIAS_1        ),
+  /*  6 */ I(OP_SEND_PROFILE , PC_FOCUS_BIAS_2        ),
+  /*  7 */ I(OP_SEND_AND_WAIT, 0x841                  ),
+  /*  8 */ I(OP_JUMP_IF_NOT  , 41                     ),
+
+  // Adjust focus servo offset cancel
+  /*  9 */ I(OP_MARK         , PH_OFFSET_CANCEL       ),
+  /* 10 */ I(OP_SEND         , 0x08                   ),
+  /* 11 */ I(OP_SEND         , 0x867                  ),
+  /* 12 */ I(OP_DELAY        , 200                    ),
+  /* 13 */ I(OP_SEND         , 0x86f                  ),
+  /* 14 */ I(OP_SEND_AND_WAIT, 0x842                  ),
+  /* 15 */ I(OP_JUMP_IF_NOT  , 41                     ),
+
+  // Laser on
+  /* 16 */ I(OP_SEND         , 0x854                  ),
+
+  // Look for focus - Each attempt finishes as soon as FOK goes high
+  /* 17 */ I(OP_MARK         , PH_FOCUS_SEARCH        ),
+  /* 18 */ I(OP_SET_COUNTER  , 3                      ),
+  /* 19 */ I(OP_SEND         , 0x47                   ),
+  /* 20 */ I(OP_WAIT_FOK     , 500                    ),
+  /* 21 */ I(OP_JUMP_IF      , 25                     ),
+  /* 22 */ I(OP_LOOP         , 19                     ),
+  /* 23 */ I(OP_SHUTDOWN     , 0                      ),
+  /* 24 */ I(OP_END          , S_NO_DISC              ),
+
+  /* 25 */ I(OP_MARK         , PH_SERVOS              ),
+  /* 26 */ I(OP_SEND         , 0x99                   ), // Set CNTL-Z register
+  /* 27 */ I(OP_SEND         , 0xae                   ), // Set CNTL-S register
+  /* 28 */ I(OP_SEND         , 0xe6                   ), // Set CNTL-C register
+  /* 29 */ I(OP_SEND         , 0x20                   ), // Disable tracking and sled servos
+  /* 30 */ I(OP_SEND         , 0x08                   ), // Enable focus
+  /* 31 */ I(OP_SEND         , 0x844                  ), // Set tracking balance
+  /* 32 */ I(OP_SEND_PROFILE , PC_BALANCE             ),
+  /* 33 */ I(OP_SEND         , 0x848                  ), // Set tracking gain
+  /* 34 */ I(OP_SEND_PROFILE , PC_GAIN                ),
+  /* 35 */ I(OP_SEND         , 0x840                  ),
+  /* 36 */ I(OP_SEND         , 0x25                   ), // Enable tracking and sled servos
+  /* 37 */ I(OP_SEND         , 0x18                   ), // Enable anti-shock and release the brake
+
+  // Wait for the frame sync to be locked - Only for the timing breakdown
+  /* 38 */ I(OP_MARK         , PH_FRAME_LOCK          ),
+  /* 39 */ I(OP_WAIT_GFS     , 2000                   ),
+  /* 40 */ I(OP_END          , S_PLAYING              ),
+
+  /* 41 */ I(OP_SHUTDOWN     , 0                      ),
+  /* 42 */ I(OP_END          , S_UNEXPECTED_ERROR     ),
+};
+
+static const uint32_t tune_script[] = {
+  /*  0 */ I(OP_SET_XRST     , 1                      ),
+  /*  1 */ I(OP_SET_STATUS   , S_LOOKING_FOR_DISC     ),
+
+  // Adjust focus error bias
+  /*  2 */ I(OP_SEND_PROFILE , PC_FOCUS_BIAS_1        ),
+  /*  3 */ I(OP_SEND_PROFILE , PC_FOCUS_BIAS_2        ),
+  /*  4 */ I(OP_SEND_AND_WAIT, 0x841                  ),
+  /*  5 */ I(OP_JUMP_IF_NOT  , 25                     ),
+
+  // Adjust focus servo offset cancel
+  /*  6 */ I(OP_SEND         , 0x08                   ),
+  /*  7 */ I(OP_SEND         , 0x867                  ),
+  /*  8 */ I(OP_DELAY        , 200                    ),
+  /*  9 */ I(OP_SEND         , 0x86f                  ),
+  /* 10 */ I(OP_SEND_AND_WAIT, 0x842                  ),
+  /* 11 */ I(OP_JUMP_IF_NOT  , 25                     ),
+
+  // Laser on
+  /* 12 */ I(OP_SEND         , 0x854                  ),
+
+  // Look for focus
+  /* 13 */ I(OP_SET_COUNTER  , 3                      ),
+  /* 14 */ I(OP_SEND         , 0x47                   ),
+  /* 15 */ I(OP_WAIT_FOK     , 500                    ),
+  /* 16 */ I(OP_JUMP_IF      , 20                     ),
+  /* 17 */ I(OP_LOOP         , 14                     ),
+  /* 18 */ I(OP_SHUTDOWN     , 0                      ),
+  /* 19 */ I(OP_END          , S_NO_DISC              ),
+
+  // Set the environment - At this point, the user can run MICOM commands to
+  // find the right tracking balance and gain values
+  /* 20 */ I(OP_SEND         , 0x08                   ),
+  /* 21 */ I(OP_SEND         , 0xe8                   ),
+  /* 22 */ I(OP_SEND         , 0x20                   ),
+  /* 23 */ I(OP_SEND         , 0x830                  ),
+  /* 24 */ I(OP_END          , S_IDLE                 ),
+
+  /* 25 */ I(OP_SHUTDOWN     , 0                      ),
+  /* 26 */ I(OP_END          , S_UNEXPECTED_ERROR     ),
+};
+
+static const uint32_t test_script[] = {
+  /*  0 */ I(OP_SET_XRST     , 0                      ),
+  /*  1 */ I(OP_SET_XRST     , 1                      ),
+
+  // Move the lens along the X axis (tracking)
+  /*  2 */ I(OP_SET_STATUS   , S_TESTING_TRACKING_COIL),
+  /*  3 */ I(OP_SET_COUNTER  , 4                      ),
+  /*  4 */ I(OP_SEND         , 0x20                   ),
+  /*  5 */ I(OP_DELAY        , 100                    ),
+  /*  6 */ I(OP_SEND         , 0x2C                   ),
+  /*  7 */ I(OP_DELAY        , 100                    ),
+  /*  8 */ I(OP_SEND         , 0x20                   ),
+  /*  9 */ I(OP_DELAY        , 100                    ),
+  /* 10 */ I(OP_SEND         , 0x28                   ),
+  /* 11 */ I(OP_DELAY        , 100                    ),
+  /* 12 */ I(OP_LOOP         , 4                      ),
+  /* 13 */ I(OP_SEND         , 0x20                   ),
+
+  // Move the optical pickup along the X axis (sled motor)
+  /* 14 */ I(OP_SET_STATUS   , S_TESTING_SLED_MOTOR   ),
+  /* 15 */ I(OP_SET_COUNTER  , 4                      ),
+  /* 16 */ I(OP_SEND         , 0x23                   ),
+  /* 17 */ I(OP_DELAY        , 100                    ),
+  /* 18 */ I(OP_SEND         , 0x20                   ),
+  /* 19 */ I(OP_DELAY        , 100                    ),
+  /* 20 */ I(OP_SEND         , 0x22                   ),
+  /* 21 */ I(OP_DELAY        , 100                    ),
+  /* 22 */ I(OP_SEND         , 0x20                   ),
+  /* 23 */ I(OP_DELAY        , 100                    ),
+  /* 24 */ I(OP_LOOP         , 16                     ),
+  /* 25 */ I(OP_SEND         , 0x20                   ),
+
+  // Move the lens up and down (focus)
+  /* 26 */ I(OP_SET_STATUS   , S_TESTING_FOCUS_COIL   ),
+  /* 27 */ I(OP_SET_COUNTER  , 4                      ),
+  /* 28 */ I(OP_SEND         , 0x47                   ),
+  /* 29 */ I(OP_DELAY        , 500                    ),
+  /* 30 */ I(OP_SEND         , 0x40                   ),
+  /* 31 */ I(OP_DELAY        , 500                    ),
+  /* 32 */ I(OP_LOOP         , 28                     ),
+
+  // Move the spindle motor in both directions
+  /* 33 */ I(OP_SET_STATUS   , S_TESTING_SPINDLE_MOTOR),
+  /* 34 */ I(OP_SEND         , 0xe8                   ),
+  /* 35 */ I(OP_DELAY        , 1000                   ),
+  /* 36 */ I(OP_SEND         , 0xe0                   ),
+  /* 37 */ I(OP_DELAY        , 1000                   ),
+  /* 38 */ I(OP_SEND         , 0xea                   ),
+  /* 39 */ I(OP_DELAY        , 1000                   ),
+  /* 40 */ I(OP_SEND         , 0xe0                   ),
+  /* 41 */ I(OP_DELAY        , 1000                   ),
+
+  /* 42 */ I(OP_SHUTDOWN     , 0                      ),
+  /* 43 */ I(OP_END          , S_IDLE                 ),
+};
+
+static const TScript built_in_scripts[] = {
+  { SCRIPT_PLAY, play_script, sizeof(play_script) / sizeof(uint32_t) },
+  { SCRIPT_TUNE, tune_script, sizeof(tune_script) / sizeof(uint32_t) },
+  { SCRIPT_TEST, test_script, sizeof(test_script) / sizeof(uint32_t) },
+  { SCRIPT_USER, NULL       , 0                                     },
+};
+
+static const TScript* find_script(const char* name) {
+  for (size_t i = 0; i < sizeof(built_in_scripts) / sizeof(TScript); i++) {
+    if (strcmp(name, built_in_scripts[i].name) == 0) {
+      return &built_in_scripts[i];
+    }
+  }
+
+  return NULL;
+}
+
+// Indicates whether a script may finish setting the given status - Only the
+// statuses of an action that has completed are allowed
+static bool is_end_status(uint16_t status) {
+  switch (status) {
+  case S_IDLE:
+  case S_ERROR_TIMED_OUT:
+  case S_UNEXPECTED_ERROR:
+  case S_NO_DISC:
+  case S_PLAYING:
+  case S_PAUSED:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+// Indicates whether a script may set the given status while it runs - The
+// internal statuses, e.g. S_WAIT_FOR_POWER, and the ones of the actions not run
+// by scripts are not allowed
+static bool is_running_status(uint16_t status) {
+  switch (status) {
+  case S_PICKUP_TO_INITIAL_POSITION:
+  case S_PICKUP_MOVE_BACKWARDS:
+  case S_TESTING_TRACKING_COIL:
+  case S_TESTING_SLED_MOTOR:
+  case S_TESTING_FOCUS_COIL:
+  case S_TESTING_SPINDLE_MOTOR:
+  case S_LOOKING_FOR_DISC:
+  case S_RUNNING_SCRIPT:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+bool script_is_known(const char* name) {
+  return find_script(name) != NULL;
+}
+
+bool script_validate(const uint32_t* code, size_t n) {
+  if (n == 0 || n > SCRIPT_MAX_LENGTH) {
+    return false;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    uint16_t op  = SCRIPT_OP_CODE(code[i]);
+    uint16_t arg = SCRIPT_OP_ARG (code[i]);
+
+    switch (op) {
+    case OP_JUMP:
+    case OP_JUMP_IF:
+    case OP_JUMP_IF_NOT:
+    case OP_LOOP:
+      if (arg >= n) {
+        return false;
+      }
+      break;
+
+    case OP_MARK:
+      if (arg >= PH_COUNT) {
+        return false;
+      }
+      break;
+
+    case OP_SEND_PROFILE:
+      if (arg >= PC_COUNT) {
+        return false;
+      }
+      break;
+
+    case OP_END:
+      if (!is_end_status(arg)) {
+        return false;
+      }
+      break;
+
+    case OP_SET_STATUS:
+      if (!is_running_status(arg)) {
+        return false;
+      }
+      break;
+
+    default:
+      if (op >= OP_COUNT) {
+        return false;
+      }
+    }
+  }
+
+  // Make sure the script cannot run past its last instruction
+  return SCRIPT_OP_CODE(code[n - 1]) == OP_END ||
+         SCRIPT_OP_CODE(code[n - 1]) == OP_JUMP;
+}
+
+size_t script_load(const char* name, uint32_t* code) {
+  const TScript* script = find_script(name);
+  nvs_handle     handle;
+  size_t         size   = SCRIPT_MAX_LENGTH * sizeof(uint32_t);
+  size_t         n      = 0;
+
+  if (script == NULL) {
+    return 0;
+  }
+
+  // An uploaded script takes precedence over the built-in one
+  if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+    if (nvs_get_blob(handle, name, code, &size) == ESP_OK) {
+      n = size / sizeof(uint32_t);
+    }
+
+    nvs_close(handle);
+  }
+
+  if (n == 0 || !script_validate(code, n)) {
+    n = script->n;
+
+    memcpy(code, script->code, n * sizeof(uint32_t));
+  }
+
+  return n;
+}
+
+int32_t script_store(const char* name, const uint32_t* code, size_t n) {
+  nvs_handle handle;
+  esp_err_t  status;
+
+  if (!script_is_known(name) || (n > 0 && !script_validate(code, n))) {
+    return -1;
+  }
+
+  if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+    return -1;
+  }
+
+  if (n == 0) {
+    status = nvs_erase_key(handle, name);
+    status = status == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : status;
+  } else {
+    status = nvs_set_blob(handle, name, code, n * sizeof(uint32_t));
+  }
+
+  if (status == ESP_OK) {
+    status = nvs_commit(handle);
+  }
+
+  nvs_close(handle);
+
+  return status == ESP_OK ? 0 : -1;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A script is a sequence of 32 bit instructions. The upper 16 bits hold the
+// operation code and the lower 16 bits hold the argument, if any.
+
+#define SCRIPT_OP(op, arg)  ((((uint32_t) (op)) << 16) | ((arg) & 0xFFFF))
+#define SCRIPT_OP_CODE(i)   ((i) >> 16)
+#define SCRIPT_OP_ARG(i)    ((i) & 0xFFFF)
+
+// Maximum number of instructions of a script
+#define SCRIPT_MAX_LENGTH   128
+
+// Names of the scripts - The built-in actions run the scripts below and any of
+// them can be replaced by uploading a new one
+#define SCRIPT_PLAY         "play"  // Start-up sequence of the PLAY action
+#define SCRIPT_TUNE         "tune"  // Sequence of the TUNE TRACKING action once
+                                    // the optical pickup is in the initial position
+#define SCRIPT_TEST         "test"  // Sequence of the TEST action
+#define SCRIPT_USER         "user"  // Free script - There is no built-in one
+
+enum kScriptOp {                    // Argument
+  OP_END = 0,                       // Status       - Finishes the script setting the status, which must be a final one
+  OP_SEND,                          // Command      - Sends a MICOM command
+  OP_DELAY,                         // mS           - Waits for a period of time
+  OP_WAIT_SENS,                     // Timeout (mS) - Waits for SENS to be high and sets the flag accordingly
+  OP_WAIT_FOK,                      // Timeout (mS) - Waits for FOK to be high and sets the flag accordingly
+  OP_JUMP,                          // Index        - Jumps to an instruction
+  OP_JUMP_IF,                       // Index        - Jumps to an instruction if the flag is set
+  OP_JUMP_IF_NOT,                   // Index        - Jumps to an instruction if the flag is not set
+  OP_SET_COUNTER,                   // Count        - Sets the loop counter
+  OP_LOOP,                          // Index        - Decrements the counter and jumps to an instruction if not zero
+  OP_SET_STATUS,                    // Status       - Sets the status of the controller, which is kept busy - Internal statuses are not allowed
+  OP_SET_XRST,                      // Level        - Sets the level of the reset line and waits for 10 mS
+  OP_SHUTDOWN,                      // -            - Stops all the servos and sets the reset line low
+  OP_SEND_AND_WAIT,                 // Command      - Sends a MICOM command, waits for its completion on SENS (1 S), taking SENS high once settled (100 mS) or on the timeout as completed, and sets the flag accordingly
+  OP_WAIT_GFS,                      // Timeout (mS) - Waits for GFS to be high and sets the flag accordingly
+  OP_MARK,                          // Phase        - Starts a phase of the timing breakdown
+  OP_SEND_PROFILE,                  // Command      - Sends a MICOM command of the calibration profile (see profile.h)
+  OP_COUNT
+};
+
+// Phases of the timing breakdown - Once a script with phases ends, the time
+// spent in each of them is reported
+enum kScriptPhase {
+  PH_RESET = 0,
+  PH_FOCUS_BIAS,
+  PH_OFFSET_CANCEL,
+  PH_FOCUS_SEARCH,
+  PH_SERVOS,
+  PH_FRAME_LOCK,
+  PH_COUNT
+};
+
+/**
+ * Checks whether a script is well formed.
+ *
+ * A script is well formed if all its operation codes are known, all the jumps
+ * point to an instruction within the script, all the statuses set are allowed
+ * for a script and the last instruction is either an END or a JUMP.
+ *
+ * @returns true, if the script is well formed; false, otherwise.
+ */
+bool script_validate(const uint32_t* code, size_t n);
+
+/**
+ * Loads a script.
+ *
+ * The script uploaded for the given name is loaded if there is any; otherwise,
+ * the built-in one is loaded. The buffer must have room for SCRIPT_MAX_LENGTH
+ * instructions.
+ *
+ * @returns the number of instructions loaded; 0, if the script is not found.
+ */
+size_t script_load(const char* name, uint32_t* code);
+
+/**
+ * Stores a script in the flash memory.
+ *
+ * The script will be used instead of the built-in one, if any, from now on. If
+ * the length is 0 the stored script is erased, so the built-in one is used
+ * again.
+ *
+ * @returns 0, on success; -1, if the script is not valid or cannot be stored.
+ */
+int32_t script_store(const char* name, const uint32_t* code, size_t n);
+
+/**
+ * Indicates whether the given name is a known script name.
+ */
+bool script_is_known(const char* name);
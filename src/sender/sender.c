@@ -1,46 +1,58 @@
 #include "actions.h"
+#include "bus.h"
 #include "common.h"
+#include "console.h"
 #include "controller.h"
+#include "frc.h"
+#include "idle.h"
+#include "latency.h"
+#include "profile.h"
+#include "replay.h"
+#include "sampler.h"
+#include "script.h"
+#include "subq.h"
+#include "trcnt.h"
 #include "wifi.h"
 
 // ESP8266
 #include "rom/ets_sys.h"
 #include "esp8266/spi_struct.h"
-#include "esp8266/timer_struct.h"
 #include "driver/gpio.h"
-#include "driver/hw_timer.h"
 
 // ESP SDK
 #include "esp_attr.h"
+#include "nvs_flash.h"
 
 // FreeRTOS
 #include "FreeRTOS.h"
 #include "freertos/task.h"
 
-#define BUFFER_READ_MS 250 // Time period between input buffer reads
+// C
+#include <stdlib.h>
+#include <string.h>
 
-static void IRAM_ATTR frc_timer_isr_cb() {
-  frc1.ctrl.en = 0;
-}
+// Options of the console that are not controller actions
+#define OPTION_PRINT_LATENCIES  'p'
+#define OPTION_RESET_LATENCIES  'P'
+#define OPTION_COMMAND_MODE     ':'
 
-static void configure_timer() {
-  /* The callback for the timer is required as the handler will enter into an
-   * infinite loop if the interrupt is not cleared
-   */
-  _xt_isr_unmask(1 << ETS_FRC_TIMER1_INUM);
-  _xt_isr_attach(ETS_FRC_TIMER1_INUM, frc_timer_isr_cb, 0);
+// Maximum length of a line of the command mode
+#define MAX_LINE_LENGTH         256
 
-  TM1_EDGE_INT_ENABLE();
+// Maximum number of MICOM commands of a line
+#define MAX_LINE_COMMANDS       64
 
-  frc1.ctrl.div       = TIMER_CLKDIV_16;
-  frc1.ctrl.intr_type = TIMER_EDGE_INT;
-  frc1.ctrl.reload    = 0;
-  frc1.ctrl.en        = 0;
-}
+// Line ending the data streamed after a command, e.g. a script
+#define END_OF_STREAM           "."
+
+// Indicates whether the console is in command mode, where the menu is not shown
+static volatile bool is_command_mode = false;
+
+static int32_t       subscriber      = -1;
 
 static void configure_gpio() {
-  PIN_PULLUP_EN  (PERIPHS_IO_MUX_MTDI_U);
-  PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDI_U, /* XLT_PORT */ FUNC_GPIO12);
+  PIN_PULLUP_EN  (PERIPHS_IO_MUX_GPIO0_U);
+  PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO0_U, /* XLT_PORT */ FUNC_GPIO0);
 
   gpio_set_direction(LED_PORT , GPIO_MODE_OUTPUT);
   SET_HI(LED_PORT);
@@ -58,6 +70,28 @@ static void configure_gpio() {
 
   gpio_set_direction(SENS_PORT, GPIO_MODE_INPUT);
   gpio_set_pull_mode(SENS_PORT, GPIO_FLOATING);
+
+  PIN_FUNC_SELECT(PERIPHS_IO_MUX_SD_DATA3_U, /* GFS_PORT */ FUNC_GPIO10);
+
+  gpio_set_direction(GFS_PORT , GPIO_MODE_INPUT);
+  gpio_set_pull_mode(GFS_PORT , GPIO_FLOATING);
+
+  PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDO_U, /* SCOR_PORT */ FUNC_GPIO15);
+
+  gpio_set_direction(SCOR_PORT, GPIO_MODE_INPUT);
+  gpio_set_pull_mode(SCOR_PORT, GPIO_FLOATING);
+
+#ifdef CONFIG_SENDER_TRCNT
+  PIN_FUNC_SELECT(PERIPHS_IO_MUX_SD_DATA2_U, /* TRCNT_PORT */ FUNC_GPIO9);
+
+  gpio_set_direction(TRCNT_PORT, GPIO_MODE_INPUT);
+  gpio_set_pull_mode(TRCNT_PORT, GPIO_FLOATING);
+#endif
+
+  // SUBQ is read through the SPI but the result of the CRC check is sampled as
+  // a GPIO, so the direction must be set
+  gpio_set_direction(SUBQ_PORT, GPIO_MODE_INPUT);
+  gpio_set_pull_mode(SUBQ_PORT, GPIO_FLOATING);
 }
 
 static void configure_spi() {
@@ -93,6 +127,8 @@ static void configure_spi() {
   PIN_PULLUP_EN(PERIPHS_IO_MUX_MTCK_U);
   PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTCK_U, FUNC_HSPID_MOSI);
 
+  PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDI_U, FUNC_HSPIQ_MISO);  // SUBQ
+
   // Set CPOL and CPHA
   SPI1.pin.ck_idle_edge      = 1; // CPOL
   SPI1.user.ck_out_edge      = 1; // CPHA
@@ -102,9 +138,11 @@ static void configure_spi() {
   SPI1.pin.cs1_dis           = 1;
   SPI1.pin.cs2_dis           = 1;
 
-  // Set endianess
+  // Set endianess - Writes are MICOM commands and reads are channel Q frames
   SPI1.ctrl.wr_bit_order     = 1; // 1: LE 0: BE
   SPI1.user.wr_byte_order    = 0; // 1: BE 0: LE
+  SPI1.ctrl.rd_bit_order     = 0; // 1: LE 0: BE
+  SPI1.user.rd_byte_order    = 1; // 1: BE 0: LE
 
   // Set clock frequency
   CLEAR_PERI_REG_MASK(PERIPHS_IO_MUX_CONF_U, SPI1_CLK_EQU_SYS_CLK);
@@ -119,12 +157,15 @@ static void configure_spi() {
   SPI1.user.ck_out_edge      = 1;
   SPI1.ctrl2.mosi_delay_num  = 1;
   SPI1.ctrl2.mosi_delay_mode = 1;
+
+  // Set MISO signal delay configuration
+  SPI1.ctrl2.miso_delay_mode = 0;
+  SPI1.ctrl2.miso_delay_num  = 0;
 }
 
 static void configure() {
   portENTER_CRITICAL();
 
-  configure_timer();
   configure_gpio ();
   configure_spi  ();
 
@@ -138,17 +179,230 @@ static void show_menu() {
     printf("%c. %s\n", actions[i].id, actions[i].description);
   }
 
+  printf("%c. %s\n", OPTION_PRINT_LATENCIES, "Print the completion times of the MICOM commands");
+  printf("%c. %s\n", OPTION_RESET_LATENCIES, "Reset the completion times of the MICOM commands");
+  printf("%c. %s\n", OPTION_COMMAND_MODE   , "Enter the command mode");
+
   printf("\n");
 }
 
+static void show_commands() {
+  printf(
+    "\n"
+    "<word> [<word>...]  Runs MICOM commands given as hex words, e.g. 0008 0025\n"
+    "script <name>       Stores a script streamed as hex instructions (see script.h)\n"
+    "replay [<speed %%>]  Replays a captured session streamed in the sniffer format\n"
+    "help                Shows this help\n"
+    "\n"
+    "Streams end with a line holding a single " END_OF_STREAM " and ESC leaves the command mode\n"
+    "\n"
+  );
+}
+
+static void print_result(int32_t result) {
+  switch (result) {
+  case CTL_QUEUE_FULL:
+    printf("The controller is busy - Please try again later\n");
+    break;
+
+  case CTL_NOT_POWERED:
+    printf("The controller is not powered\n");
+    break;
+
+  case CTL_NOT_RUNNING:
+    printf("The controller stopped reading the data\n");
+    break;
+  }
+}
+
 static void process_option(char option) {
+  switch (option) {
+  case OPTION_PRINT_LATENCIES:
+    lat_print();
+    return;
+
+  case OPTION_RESET_LATENCIES:
+    lat_reset();
+    return;
+  }
+
   for (size_t i = 0; i < sizeof(actions) / sizeof(TAction); i++) {
     if (option == actions[i].id) {
-      actions[i].fn();
+      print_result(actions[i].fn());
+
+      break;
+    }
+  }
+}
+
+static void print_micom_results(size_t n, const uint16_t* commands, const uint8_t* results) {
+  static const char* result_text[] = { "Sent", "Completed", "Timed out", "Cancelled" };
+
+  for (size_t i = 0; i < n; i++) {
+    printf("%04x: %s\n", commands[i], result_text[results[i]]);
+  }
+}
+
+// Runs the MICOM commands given as hex words in a line
+static void run_commands(char* line) {
+  uint16_t* commands = (uint16_t*) malloc(MAX_LINE_COMMANDS * sizeof(uint16_t));
+  size_t    n        = 0;
+  char*     end;
+
+  if (commands == NULL) {
+    printf("Out of memory\n");
+
+    return;
+  }
+
+  for (char* word = strtok(line, " \t"); word != NULL; word = strtok(NULL, " \t")) {
+    unsigned long command = strtoul(word, &end, 16);
+
+    if (*end != '\0' || command > 0xFFFF || n == MAX_LINE_COMMANDS) {
+      printf("Invalid MICOM command: %s\n", word);
+
+      free(commands);
+
+      return;
+    }
+
+    commands[n++] = command;
+  }
+
+  // The buffer is owned by the controller from now on
+  print_result(ctl_run_micom_commands(n, commands, print_micom_results));
+}
+
+// Stores a script streamed as hex instructions, up to the end of the stream
+static void store_script(const char* name) {
+  uint32_t* code = (uint32_t*) malloc(SCRIPT_MAX_LENGTH * sizeof(uint32_t));
+  char      line[MAX_LINE_LENGTH];
+  size_t    n     = 0;
+  bool      is_ok = code != NULL && script_is_known(name);
+  char*     end;
+
+  // The whole stream is read even if the script is not valid so it is not
+  // taken for commands
+  while (con_read_line(line, sizeof(line), false) != CON_CANCELLED && strcmp(line, END_OF_STREAM) != 0) {
+    for (char* word = strtok(line, " \t"); is_ok && word != NULL; word = strtok(NULL, " \t")) {
+      // A script too long is rejected before overflowing the buffer
+      if (n == SCRIPT_MAX_LENGTH) {
+        is_ok = false;
+        break;
+      }
+
+      code[n++] = strtoul(word, &end, 16);
+
+      is_ok     = *end == '\0';
+    }
+  }
+
+  if (is_ok && script_store(name, code, n) == 0) {
+    printf("Script %s stored (%u instructions)\n", name, n);
+  } else {
+    printf("Failed to store the script %s\n", name);
+  }
+
+  free(code);
+}
+
+static bool write_replay_command(const TReplayCommand* command, void* arg) {
+  return ctl_replay_write(command) == CTL_OK;
+}
+
+// Replays a captured session as it is streamed, up to the end of the stream
+static void replay_session(uint16_t speed_pct) {
+  char          line[MAX_LINE_LENGTH];
+  int32_t       result = ctl_replay(speed_pct);
+  uint8_t       status = RPL_OK;
+  TReplayParser parser;
+
+  rpl_init(&parser);
+
+  // The whole stream is read even if the replay fails so it is not taken for
+  // commands
+  while (con_read_line(line, sizeof(line), false) != CON_CANCELLED && strcmp(line, END_OF_STREAM) != 0) {
+    if (result == CTL_OK && status == RPL_OK) {
+      status = rpl_parse(&parser, line, strlen(line), write_replay_command, NULL);
+
+      // The line ending is not stored so the last token is completed here
+      if (status == RPL_OK) {
+        status = rpl_parse(&parser, "\n", 1, write_replay_command, NULL);
+      }
+    }
+  }
+
+  if (result != CTL_OK) {
+    print_result(result);
+
+    return;
+  }
+
+  ctl_replay_end();
+
+  if (status == RPL_SYNTAX_ERROR) {
+    printf("Syntax error at line %u\n", parser.line);
+  } else if (status == RPL_ABORTED) {
+    print_result(CTL_NOT_RUNNING);
+  }
+}
+
+// Indicates whether the first word of a line, of the given length, is the given
+// command
+static bool is_command(const char* line, size_t length, const char* command) {
+  return length == strlen(command) && strncmp(line, command, length) == 0;
+}
+
+static void process_command(char* line) {
+  char     name[32 + 1];
+  uint16_t speed_pct = 0;
+  size_t   length;
+
+  line  += strspn (line, " \t");
+  length = strcspn(line, " \t");
+
+  if (length == 0) {
+    return;
+  }
+
+  if (is_command(line, length, "help")) {
+    show_commands();
+  } else if (is_command(line, length, "script")) {
+    if (sscanf(line + length, "%32s", name) == 1) {
+      store_script(name);
+    } else {
+      printf("The name of the script is missing\n");
+    }
+  } else if (is_command(line, length, "replay")) {
+    sscanf(line + length, "%hu", &speed_pct);
+
+    replay_session(speed_pct);
+  } else {
+    run_commands(line);
+  }
+}
+
+static void run_command_mode() {
+  char line[MAX_LINE_LENGTH];
+
+  is_command_mode = true;
 
+  printf("Command mode - Type help for the commands and ESC to leave\n");
+
+  while (true) {
+    printf("> ");
+    fflush(stdout);
+
+    if (con_read_line(line, sizeof(line), true) == CON_CANCELLED) {
       break;
     }
+
+    process_command(line);
   }
+
+  is_command_mode = false;
+
+  show_menu();
 }
 
 static void handle_ctl_update(const TEvent* status) {
@@ -157,17 +411,62 @@ static void handle_ctl_update(const TEvent* status) {
 
   printf("\033[1mStatus\033[22m: %s\n", status->status_text);
 
-  if (!status->is_busy && status->is_powered) {
+  if (!status->is_busy && status->is_powered && !is_command_mode) {
     show_menu();
+  }
+}
+
+// Prints the status changes while the console is read by the main task
+static void print_events_task() {
+  TEvent event;
+
+  while (true) {
+    switch (ctl_read_event(subscriber, &event, portMAX_DELAY)) {
+    case E_OK:
+      handle_ctl_update(&event);
+      break;
 
-    // Clear input buffer after an action has been completed
-    while ((fgetc(stdin)) != EOF);
+    case E_OVERRUN:
+      printf("Some status changes were missed\n");
+      break;
+    }
   }
 }
 
 void run_sender() {
   configure();
 
+  // Initialize the storage system, so it's available to other services
+  if (nvs_flash_init() != ESP_OK) {
+    printf("Failed to initialize the storage system - Only built-in scripts will be available...\n");
+  }
+
+  // Start the timer service - It takes over the FRC1 timer
+  frc_start();
+
+  // Halt the CPU while there is nothing to do and account the time halted
+  idle_start();
+
+  // Load the calibration profile of the mechanism - The default one is used if
+  // the unit has not been calibrated yet
+  profile_load();
+
+  // Start sampling the ADC pin, which tells the controller whether the board
+  // is powered and whether the limit switch is pressed
+  smp_start();
+
+  // Share the SPI between the MICOM interface and the channel Q, switching its
+  // configuration as each one is granted the bus
+  bus_start();
+
+  // Read the channel Q as soon as the disc is spinning - The SCOR interrupt is
+  // handled by the controller so it must be set up first
+  subq_start();
+
+  // Count the tracks crossed while the sled is kicked, if TRCNT is enabled - The
+  // TRCNT interrupt is also handled by the controller
+  trc_start();
+
   // Initialize the controller
   ctl_start();
 
@@ -177,17 +476,22 @@ void run_sender() {
   }
 #endif
 
-  // Add the listener after the WiFi, if enabled, has been started as it prints
-  // some information to the console
-  ctl_add_listener(handle_ctl_update);
+  // Subscribe after the WiFi, if enabled, has been started as it prints some
+  // information to the console
+  subscriber = ctl_subscribe();
+
+  xTaskCreate(print_events_task, "senderEvents", 1024, NULL, 1, NULL);
+
+  // Each option is processed as soon as it is received
+  con_start();
 
   while (true) {
-    int option = fgetc(stdin);
+    int32_t option = con_read(portMAX_DELAY);
 
-    if (option != EOF) {
+    if (option == OPTION_COMMAND_MODE) {
+      run_command_mode();
+    } else if (option != CON_NONE) {
       process_option(option);
     }
-
-    vTaskDelay(BUFFER_READ_MS / portTICK_RATE_MS);
   }
 }
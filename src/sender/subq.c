@@ -0,0 +1,303 @@
+#include "subq.h"
+#include "bus.h"
+#include "common.h"
+
+// ESP8266
+#include "esp8266/gpio_struct.h"
+#include "esp8266/spi_struct.h"
+#include "driver/gpio.h"
+
+// ESP SDK
+#include "esp_attr.h"
+
+// FreeRTOS
+#include "FreeRTOS.h"
+#include "freertos/task.h"
+
+// C
+#include <string.h>
+
+// Size of the ring of frames - A frame is signaled every 1 / 75 s (13.3 mS) so
+// the ring holds the last second or so
+#define RING_SIZE           64
+
+// Maximum number of subscribers allowed
+#define MAX_SUBSCRIBERS     4
+
+// Length of a frame read through the SPI - The CRC is not read
+#define FRAME_BITS          80
+
+// Maximum wait for the bus from the falling edge of SCOR - A read delayed any
+// longer by a MICOM burst is dropped rather than risk reading the register while
+// the next frame is loaded into it
+#define READ_DEADLINE_US    1000
+
+// Macro for reversing a sequence of 4 bits
+#define REVERSE(x) ((((x) >> 3) & 0x1) | \
+                    (((x) >> 1) & 0x2) | \
+                    (((x) << 1) & 0x4) | \
+                    (((x) << 3) & 0x8))
+
+// Macro for converting a 2 digit BCD encoded number to a decimal number
+#define BCD2DEC(x) ((((x) >> 4) & 0xf) * 10 + ((x) & 0xf))
+
+// Macro for reading a 2 digit field of a frame - The bits of each digit arrive
+// in reverse order
+#define FIELD(w, s) ((REVERSE(((w) >> ((s) + 4)) & 0xf) << 4) | \
+                     (REVERSE(((w) >>  (s)     ) & 0xf)     ))
+
+typedef struct {
+  uint32_t     cursor;  // Sequence number of the next frame to read
+  TaskHandle_t task;    // The task reading the frames - Notified on new frames
+} TSubscriber;
+
+// The ring of frames - The frames are written by the interrupt handler as they
+// are read through the SPI, so a reader only needs to check the sequence number
+// once it has copied a frame
+static DRAM_ATTR uint32_t          ring[RING_SIZE][3];
+static DRAM_ATTR volatile uint32_t sequence       = 0; // Sequence number of the next frame
+static DRAM_ATTR volatile size_t   n_subscribers  = 0;
+static DRAM_ATTR TSubscriber       subscribers[MAX_SUBSCRIBERS];
+
+static DRAM_ATTR volatile TSubQStats stats;
+
+static TToc                        toc;
+
+static bool IRAM_ATTR is_valid_bcd(uint8_t x) {
+  return (x & 0xf) <= 9 && (x >> 4) <= 9;
+}
+
+// Decodes a frame as laid out in the SPI buffer
+//
+// @returns true, if all the fields hold sane values; false, otherwise.
+static bool IRAM_ATTR decode(const uint32_t* frame, TSubQ* q) {
+  uint32_t q0     = frame[0];
+  uint32_t q1     = frame[1];
+  uint32_t q2     = frame[2] >> 16;
+  uint8_t  tno    = FIELD(q0, 16);
+  uint8_t  min    = FIELD(q0,  0);
+  uint8_t  sec    = FIELD(q1, 24);
+  uint8_t  frm    = FIELD(q1, 16);
+  uint8_t  amin   = FIELD(q1,  0);
+  uint8_t  asec   = FIELD(q2,  8);
+  uint8_t  aframe = FIELD(q2,  0);
+
+  if (
+    (tno != SUBQ_LEAD_OUT && !is_valid_bcd(tno)) ||
+    !is_valid_bcd(min ) || !is_valid_bcd(sec ) || !is_valid_bcd(frm   ) ||
+    !is_valid_bcd(amin) || !is_valid_bcd(asec) || !is_valid_bcd(aframe)
+  ) {
+    return false;
+  }
+
+  q->control = REVERSE((q0 >> 28) & 0xf);
+  q->tno     = tno == SUBQ_LEAD_OUT ? tno : BCD2DEC(tno);
+  q->point   = FIELD(q0, 8);
+  q->time    = SUBQ_FRAMES(BCD2DEC(min ), BCD2DEC(sec ), BCD2DEC(frm   ));
+  q->atime   = SUBQ_FRAMES(BCD2DEC(amin), BCD2DEC(asec), BCD2DEC(aframe));
+
+  return true;
+}
+
+static void IRAM_ATTR update_toc(const TSubQ* q) {
+  portENTER_CRITICAL();
+
+  switch (q->point) {
+  case 0xA0:
+    toc.first    = q->atime / SUBQ_FRAMES(1, 0, 0);
+    break;
+
+  case 0xA1:
+    toc.last     = q->atime / SUBQ_FRAMES(1, 0, 0);
+    break;
+
+  case 0xA2:
+    toc.lead_out = q->atime;
+    break;
+
+  default:
+    if (is_valid_bcd(q->point) && q->point != 0) {
+      toc.start[BCD2DEC(q->point)] = q->atime;
+    }
+  }
+
+  portEXIT_CRITICAL();
+}
+
+// Reads the frame once the bus is granted, which is right away unless a MICOM
+// command is being transmitted
+static bool IRAM_ATTR read_frame() {
+  BaseType_t woken = pdFALSE;
+  uint32_t*  frame;
+
+  SPI1.user1.usr_miso_bitlen = FRAME_BITS - 1;
+
+  // Start the operation - The clock also runs through the MICOM interface but
+  // the ICs ignore it as the latch signal is not triggered
+  SPI1.cmd.usr               = 1;
+
+  while (SPI1.cmd.usr == 1);
+
+  // The interrupt status is cleared so the end of this operation is not taken
+  // for the end of a MICOM command
+  SPI1.slave.val            &= ~0x1F;
+
+  if (REVERSE((SPI1.data_buf[0] >> 24) & 0xf) == /* Mode 1 */ 1) {
+    frame    = ring[sequence % RING_SIZE];
+    frame[0] = SPI1.data_buf[0];
+    frame[1] = SPI1.data_buf[1];
+    frame[2] = SPI1.data_buf[2];
+
+    sequence++;
+
+    for (size_t i = 0; i < n_subscribers; i++) {
+      if (subscribers[i].task != NULL) {
+        vTaskNotifyGiveFromISR(subscribers[i].task, &woken);
+      }
+    }
+  }
+
+  if (bus_release(B_SUBQ)) {
+    woken = pdTRUE;
+  }
+
+  return woken == pdTRUE;
+}
+
+void subq_start() {
+  bus_set_handler(B_SUBQ, read_frame, READ_DEADLINE_US);
+
+  GPIO.pin[SCOR_PORT].int_type = GPIO_INTR_NEGEDGE;
+}
+
+bool IRAM_ATTR subq_handle_scor() {
+  bool is_crc_ok;
+
+  stats.n_frames++;
+
+  // The result of the CRC check is output on SUBQ while SCOR is low
+  PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDI_U, FUNC_GPIO12);
+
+  is_crc_ok = ((GPIO.in >> SUBQ_PORT) & 0x1) == 1;
+
+  PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDI_U, FUNC_HSPIQ_MISO);
+
+  if (!is_crc_ok) {
+    stats.n_crc_errors++;
+
+    return false;
+  }
+
+  return bus_request(B_SUBQ);
+}
+
+int32_t subq_subscribe() {
+  int32_t id = -1;
+
+  portENTER_CRITICAL();
+
+  if (n_subscribers < MAX_SUBSCRIBERS) {
+    id = n_subscribers;
+
+    subscribers[id].cursor = sequence;
+    subscribers[id].task   = NULL;
+
+    n_subscribers++;
+  }
+
+  portEXIT_CRITICAL();
+
+  return id;
+}
+
+uint8_t subq_read(int32_t subscriber, TSubQ* q, uint32_t timeout_ms) {
+  TSubscriber* s     = &subscribers[subscriber];
+  TickType_t   start = xTaskGetTickCount();
+  TickType_t   ticks = timeout_ms / portTICK_RATE_MS;
+  TickType_t   elapsed;
+  uint32_t     frame[3];
+
+  s->task = xTaskGetCurrentTaskHandle();
+
+  while (true) {
+    uint32_t head = sequence;
+
+    if (head - s->cursor > RING_SIZE) {
+      s->cursor = head - RING_SIZE;
+
+      return Q_OVERRUN;
+    }
+
+    if (s->cursor != head) {
+      memcpy(frame, ring[s->cursor % RING_SIZE], sizeof(frame));
+
+      // The frame may have been overwritten while it was copied, which is
+      // reported as an overrun on the next iteration
+      if (sequence - s->cursor > RING_SIZE) {
+        continue;
+      }
+
+      s->cursor++;
+
+      if (!decode(frame, q)) {
+        continue;
+      }
+
+      if (q->tno == SUBQ_LEAD_IN) {
+        update_toc(q);
+      }
+
+      return Q_OK;
+    }
+
+    if ((elapsed = xTaskGetTickCount() - start) >= ticks) {
+      return Q_NONE;
+    }
+
+    // A frame written after the check above leaves the notification pending so
+    // it is not missed
+    ulTaskNotifyTake(pdTRUE, ticks - elapsed);
+  }
+}
+
+void subq_skip(int32_t subscriber) {
+  subscribers[subscriber].cursor = sequence;
+}
+
+bool subq_get_toc(TToc* t) {
+  bool is_complete;
+
+  portENTER_CRITICAL();
+
+  *t = toc;
+
+  portEXIT_CRITICAL();
+
+  is_complete = t->first    > 0        &&
+                t->last    >= t->first &&
+                t->last    <= SUBQ_MAX_TRACKS &&
+                t->lead_out > 0;
+
+  for (size_t i = t->first; is_complete && i <= t->last; i++) {
+    is_complete = t->start[i] > 0;
+  }
+
+  return is_complete;
+}
+
+void subq_reset_toc() {
+  portENTER_CRITICAL();
+
+  memset(&toc, 0, sizeof(TToc));
+
+  portEXIT_CRITICAL();
+}
+
+void subq_get_stats(TSubQStats* s) {
+  portENTER_CRITICAL();
+
+  s->n_frames     = stats.n_frames;
+  s->n_crc_errors = stats.n_crc_errors;
+
+  portEXIT_CRITICAL();
+}
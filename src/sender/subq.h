@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Values of the track number outside the program area
+#define SUBQ_LEAD_IN        0x00
+#define SUBQ_LEAD_OUT       0xAA
+
+// Maximum number of tracks of a disc
+#define SUBQ_MAX_TRACKS     99
+
+// Macro for converting a time given in minutes, seconds and frames to frames
+#define SUBQ_FRAMES(m, s, f) ((((m) * 60) + (s)) * 75 + (f))
+
+// A Mode 1 frame of the channel Q, decoded - All the times are given in frames
+// (1 / 75 S). In the lead-in the absolute time holds the time of the point
+typedef struct {
+  uint8_t     control;  // Control field (CONTROL)
+  uint8_t     tno;      // Track number - SUBQ_LEAD_IN, SUBQ_LEAD_OUT or 1..99
+  uint8_t     point;    // Index (X) or, in the lead-in, the point (POINT) as BCD
+  uint32_t    time;     // Time within the track (MIN, SEC and FRAME)
+  uint32_t    atime;    // Absolute time (AMIN, ASEC and AFRAME) or the time of
+                        // the point (PMIN, PSEC and PFRAME) in the lead-in
+} TSubQ;
+
+// Table of contents - Collected from the lead-in frames read
+typedef struct {
+  uint8_t     first;                      // Number of the first track
+  uint8_t     last;                       // Number of the last track
+  uint32_t    lead_out;                   // Absolute time of the lead-out
+  uint32_t    start[SUBQ_MAX_TRACKS + 1]; // Absolute time of each track
+} TToc;
+
+// Counters of the frames signaled by SCOR
+typedef struct {
+  uint32_t    n_frames;     // Frames signaled
+  uint32_t    n_crc_errors; // Frames failing the CRC check
+} TSubQStats;
+
+// Result codes of the API reading frames
+enum kSubQResult {
+  Q_OK = 0,   // A frame has been read
+  Q_NONE,     // There were no new frames before the timeout expired
+  Q_OVERRUN,  // Some frames were overwritten before being read - The next read
+              // returns the oldest frame available
+};
+
+/**
+ * Starts reading the channel Q.
+ *
+ * A frame is read every time SCOR signals a new one, provided it passes the
+ * CRC check, and kept in a ring shared by all the subscribers. This API must be
+ * called after the bus arbiter has been started and before the GPIO interrupt
+ * is enabled.
+ */
+void subq_start();
+
+/**
+ * Handles the falling edge of SCOR.
+ *
+ * This function must be called from the GPIO interrupt handler. The SPI is
+ * shared with the MICOM interface so the frame is read once the command being
+ * transmitted, if any, is latched (see bus.h).
+ *
+ * @returns true, if a task has been woken up.
+ */
+bool subq_handle_scor();
+
+/**
+ * Registers a new subscriber to the frames.
+ *
+ * The first frame read by a new subscriber is the next one signaled.
+ *
+ * @returns the identifier of the subscriber, on success; -1, if no more
+ * subscribers can be registered.
+ */
+int32_t subq_subscribe();
+
+/**
+ * Reads the next frame of a subscriber.
+ *
+ * If there are no new frames the calling task is blocked until a frame is read
+ * or the timeout expires, whichever occurs first. The table of contents is
+ * updated with every lead-in frame read.
+ *
+ * @returns one of kSubQResult.
+ */
+uint8_t subq_read(int32_t subscriber, TSubQ* q, uint32_t timeout_ms);
+
+/**
+ * Drops the frames of a subscriber not read yet.
+ */
+void subq_skip(int32_t subscriber);
+
+/**
+ * Gets the table of contents.
+ *
+ * @returns true, if the table of contents is complete; false, otherwise.
+ */
+bool subq_get_toc(TToc* toc);
+
+/**
+ * Forgets the table of contents, e.g. as the disc may have been replaced.
+ */
+void subq_reset_toc();
+
+/**
+ * Gets the counters of the frames signaled since the start.
+ */
+void subq_get_stats(TSubQStats* stats);
@@ -0,0 +1,148 @@
+#include "trcnt.h"
+#include "common.h"
+#include "frc.h"
+
+// ESP8266
+#include "esp8266/gpio_struct.h"
+#include "driver/gpio.h"
+
+// ESP SDK
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "driver/soc.h"
+
+// FreeRTOS
+#include "FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char*                 module_id    = "trcnt";
+
+static DRAM_ATTR volatile uint32_t count        = 0;    // Crossings since the start
+static DRAM_ATTR volatile uint32_t alarm        = 0;    // Count at which the alarm task is notified
+static DRAM_ATTR TaskHandle_t      alarm_task   = NULL;
+
+static DRAM_ATTR uint32_t          gate_count   = 0;    // Count at the start of the gate window
+static DRAM_ATTR bool              is_gate_open = false;
+static DRAM_ATTR volatile bool     is_kicking   = false;
+static volatile uint32_t           rate         = 0;
+
+static uint32_t                    kick_start   = 0;    // Count at the start of the kick
+static uint32_t                    kick_cycles  = 0;    // CPU cycle count at the start of the kick
+static TTrackCrossings             last_kick;
+
+// Enables or disables the TRCNT interrupt - Must be called in a critical section
+// or from an interrupt handler
+static void IRAM_ATTR arm(bool is_armed) {
+#ifdef CONFIG_SENDER_TRCNT
+  if (is_armed) {
+    GPIO.status_w1tc = BIT(TRCNT_PORT);
+  }
+
+  GPIO.pin[TRCNT_PORT].int_type = is_armed ? GPIO_INTR_POSEDGE : GPIO_INTR_DISABLE;
+#endif
+}
+
+// Opens a gate window at the start of every rate period and closes it once it
+// expires, measuring the rate from the crossings counted within the window
+static uint32_t IRAM_ATTR measure(void* arg) {
+  uint32_t c = count;
+
+  if (!is_gate_open) {
+    gate_count   = c;
+    is_gate_open = true;
+
+    arm(true);
+
+    return TRC_GATE_MS * 1000;
+  }
+
+  rate         = (c - gate_count) * (1000 / TRC_GATE_MS);
+  is_gate_open = false;
+
+  // The crossings of a kick are counted during the whole kick
+  if (!is_kicking) {
+    arm(false);
+  }
+
+  return (TRC_RATE_PERIOD_MS - TRC_GATE_MS) * 1000;
+}
+
+void trc_start() {
+  if (frc_add(TRC_GATE_MS * 1000, measure, NULL) < 0) {
+    ESP_LOGE(module_id, "Failed to start the rate timer");
+  }
+}
+
+bool IRAM_ATTR trc_handle_edge() {
+  BaseType_t woken = pdFALSE;
+
+  if (++count == alarm && alarm_task != NULL) {
+    vTaskNotifyGiveFromISR(alarm_task, &woken);
+
+    alarm_task = NULL;
+  }
+
+  return woken == pdTRUE;
+}
+
+uint32_t trc_get_count() {
+  return count;
+}
+
+void trc_set_alarm(uint32_t n) {
+  portENTER_CRITICAL();
+
+  alarm      = count + n;
+  alarm_task = xTaskGetCurrentTaskHandle();
+
+  portEXIT_CRITICAL();
+}
+
+void trc_clear_alarm() {
+  portENTER_CRITICAL();
+
+  alarm_task = NULL;
+
+  portEXIT_CRITICAL();
+}
+
+void trc_begin_kick() {
+  kick_start  = count;
+  kick_cycles = soc_get_ccount();
+
+  // TRCNT toggles at up to 20 kHz while the sled moves so its interrupt is only
+  // enabled during the kicks and the gate windows of the rate
+  portENTER_CRITICAL();
+
+  is_kicking = true;
+
+  arm(true);
+
+  portEXIT_CRITICAL();
+}
+
+void trc_end_kick() {
+  portENTER_CRITICAL();
+
+  is_kicking = false;
+
+  if (!is_gate_open) {
+    arm(false);
+  }
+
+  last_kick.kick_count = count - kick_start;
+  last_kick.kick_us    = CYCLES_TO_US(soc_get_ccount() - kick_cycles);
+
+  portEXIT_CRITICAL();
+}
+
+void trc_get(TTrackCrossings* crossings) {
+  portENTER_CRITICAL();
+
+  crossings->count      = count;
+  crossings->rate       = rate;
+  crossings->kick_count = last_kick.kick_count;
+  crossings->kick_us    = last_kick.kick_us;
+
+  portEXIT_CRITICAL();
+}
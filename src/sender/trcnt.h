@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Period of the measurement of the crossing rate
+#define TRC_RATE_PERIOD_MS  100
+
+// Time TRCNT is counted within every period for measuring the crossing rate -
+// It bounds the load of the interrupt while playing
+#define TRC_GATE_MS          10
+
+// Track crossings counted from the TRCNT line
+typedef struct {
+  uint32_t    count;      // Crossings since the start
+  uint32_t    rate;       // Crossings per second during the last gate window
+  uint32_t    kick_count; // Crossings during the last sled kick
+  uint32_t    kick_us;    // Duration of the last sled kick
+} TTrackCrossings;
+
+/**
+ * Starts counting the track crossings.
+ *
+ * Every rising edge of TRCNT during a sled kick is counted by the GPIO interrupt
+ * handler. The crossing rate is measured by a timer, which counts the edges for
+ * TRC_GATE_MS every TRC_RATE_PERIOD_MS so the interrupt load is bounded while
+ * playing. Nothing is counted if CONFIG_SENDER_TRCNT is not enabled. This API must be called after the timer
+ * service has been started and before the GPIO interrupt is enabled.
+ */
+void trc_start();
+
+/**
+ * Handles the rising edge of TRCNT.
+ *
+ * This function must be called from the GPIO interrupt handler.
+ *
+ * @returns true, if the task waiting on the alarm has been woken up.
+ */
+bool trc_handle_edge();
+
+/**
+ * Returns the number of crossings since the start.
+ */
+uint32_t trc_get_count();
+
+/**
+ * Sets an alarm for the given number of crossings from now.
+ *
+ * The calling task is notified once the crossings are counted. Only one alarm
+ * can be set at a time; setting a new one replaces the previous one.
+ */
+void trc_set_alarm(uint32_t n);
+
+/**
+ * Clears the alarm, if any.
+ */
+void trc_clear_alarm();
+
+/**
+ * Marks the start and the end of a sled kick so the crossings during the kick
+ * are counted - The crossings are only counted during the kicks and the gate
+ * windows of the rate.
+ */
+void trc_begin_kick();
+void trc_end_kick();
+
+/**
+ * Gets the track crossings counted.
+ */
+void trc_get(TTrackCrossings* crossings);
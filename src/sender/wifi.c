@@ -1,6 +1,13 @@
 #include "actions.h"
+#include "bus.h"
+#include "common.h"
 #include "controller.h"
+#include "idle.h"
+#include "latency.h"
+#include "profile.h"
 #include "resources.h"
+#include "script.h"
+#include "trcnt.h"
 
 // ESP SDK
 #include "esp_err.h"
@@ -8,40 +15,83 @@
 #include "esp_log.h"
 #include "esp_http_server.h"
 #include "esp_wifi.h"
-#include "nvs_flash.h"
+#include "driver/soc.h"
+#include "lwip/sockets.h"
 
 // FreeRTOS
 #include "FreeRTOS.h"
 #include "freertos/task.h"
 
 // C
-#include <sys/socket.h>
+#include <ctype.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
-#define STATUS_READ_MS      250 // Time period between status reads
+// The events are read from the controller in batches
+#define EVENTS_PER_BATCH      4
+#define EVENT_LENGTH        128 // Maximum length of an event in JSON
+#define BATCH_LENGTH        (EVENTS_PER_BATCH * (EVENT_LENGTH + 1) + 2)
+#define MESSAGE_LENGTH      (BATCH_LENGTH + 24) // Maximum length of a pushed batch
 
-// Timeout waiting on the status to change in ticks
-// This can be calculated as (1000 / STATUS_READ_MS) * N_SEC
-#define STATUS_TIMEOUT_T      8
+// Cursor of a client that has not seen any event - It is ahead of all the events
+// so the client gets the current status
+#define NO_CURSOR           UINT32_MAX
 
-#define EVENT_BUFFER_SIZE    16 // Size of the event buffer
-#define MAX_COMMAND_LENGTH  512 // Maximum number of commands to read
+#define MAX_PUSH_CLIENTS      4 // Maximum number of clients of the status push
+#define PUSH_READ_MS       1000 // Time period between event reads of the push
+#define PUSH_SEND_MS        200 // Longest time a client of the push may stall a send
 
-static const char* module_id = "wifi";
+#define MAX_COMMAND_LENGTH  512 // Maximum number of commands to read
+#define MAX_REPLAY_LENGTH 32768 // Maximum length of a session to replay
 
-static TEvent events[EVENT_BUFFER_SIZE];
-static size_t read_idx  = 0;
-static size_t write_idx = 0;
+#define HTTPD_503           "503 Service Unavailable"
 
-static void handle_ctl_update(const TEvent* event) {
-  events[write_idx].is_busy     = event->is_busy;
-  events[write_idx].is_powered  = event->is_powered;
-  events[write_idx].status_text = event->status_text;
+static const char* module_id = "wifi";
 
-  if (++write_idx == EVENT_BUFFER_SIZE) {
-    write_idx = 0;
-  }
+// A client of the status push - The slot is freed by the HTTP server once the
+// session of the client is closed
+typedef struct {
+  bool        is_used;
+  int         socket_fd;
+  uint32_t    cursor;     // Sequence number of the next event to push
+} TPushClient;
+
+static httpd_handle_t http_server = NULL;
+
+// The subscriber to the events only wakes up the push task - The events are
+// read from the cursor of each client
+static int32_t  subscriber = -1;
+
+// The clients of the status push are only accessed from the HTTP server task
+static TPushClient   push_clients[MAX_PUSH_CLIENTS];
+static volatile bool is_push_queued = false;
+
+// CPU cycle count when the last action was requested - The time until its first
+// event is pushed to the clients is published with the timing stats
+static uint32_t    action_cycles = 0;
+
+// The times from an action request until its first event is pushed - Only
+// accessed from the HTTP server task
+static uint32_t    n_pushes          = 0;
+static uint32_t    last_push_us      = 0;
+static size_t      last_push_clients = 0;
+static uint32_t    max_push_us       = 0;
+static uint32_t    total_push_us     = 0;
+
+static size_t   n_results = 0;
+static uint16_t result_commands[MAX_COMMAND_LENGTH];
+static uint8_t  results        [MAX_COMMAND_LENGTH];
+
+static void handle_micom_results(
+  size_t          n,
+  const uint16_t* commands,
+  const uint8_t*  command_results
+) {
+  memcpy(result_commands, commands       , n * sizeof(uint16_t));
+  memcpy(results        , command_results, n * sizeof(uint8_t ));
+
+  n_results = n;
 }
 
 static esp_err_t handle_get_resource(httpd_req_t* request) {
@@ -87,45 +137,287 @@ static esp_err_t handle_get_actions(httpd_req_t* request) {
   return httpd_resp_send_chunk(request, NULL, 0);
 }
 
+static esp_err_t handle_get_commands(httpd_req_t* request) {
+  char buffer[32 + 1];
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  // Send the completion status of each command of the last batch processed
+  httpd_resp_send_chunk(request, "[", 1);
+
+  for (size_t i = 0; i < n_results; i++) {
+    sprintf(buffer,
+      "{\"c\":\"%x\",\"r\":%d}", result_commands[i], results[i]
+    );
+
+    httpd_resp_send_chunk(request, buffer, -1);
+
+    if (i + 1 < n_results) {
+      httpd_resp_send_chunk(request, ",", 1);
+    }
+  }
+
+  httpd_resp_send_chunk(request, "]", 1);
+
+  return httpd_resp_send_chunk(request, NULL, 0);
+}
+
+// Writes a batch of events as a JSON array - Each event holds its sequence
+// number, the controller status, its friendly description and the flag
+// indicating whether the controller is busy or not. The first event of a batch
+// read on a resync is flagged as it is a snapshot of the current status
+static void format_events(char* buffer, const TEvent* events, size_t n, bool is_resync) {
+  buffer += sprintf(buffer, "[");
+
+  for (size_t i = 0; i < n; i++) {
+    buffer += sprintf(
+      buffer,
+      "%s{\"q\":%u,\"r\":%d,\"s\":%d,\"t\":\"%s\",\"b\":%d}",
+      i > 0 ? "," : "",
+      events[i].sequence,
+      is_resync && i == 0,
+      events[i].is_powered,
+      events[i].status_text,
+      events[i].is_busy
+    );
+  }
+
+  sprintf(buffer, "]");
+}
+
+// Gets the cursor of a client given the sequence number of the last event it has
+// seen, if any
+static uint32_t get_cursor(const char* last_sequence) {
+  char*    end;
+  uint32_t sequence = strtoul(last_sequence, &end, 10);
+
+  return *last_sequence >= '0' && *last_sequence <= '9' && *end == '\0'
+         ? sequence + 1
+         : NO_CURSOR;
+}
+
 static esp_err_t handle_get_status(httpd_req_t* request) {
-  char   buffer[256 + 1];
-  size_t idx;
-  int    socket_fd;
-
-  // Wait for the status to change or the timeout to expire or the client to
-  // abort the request, whichever occurs first
-  socket_fd = httpd_req_to_sockfd(request);
-
-  for (size_t i = 0; read_idx == write_idx && i < STATUS_TIMEOUT_T; i++) {
-    // If this call returns 0 then there is no bytes pending to be to read,
-    // which means the client, potentially, closed the socket on its end
-    if (recv(socket_fd, NULL, 0, MSG_DONTWAIT) == 0) {
-      return ESP_FAIL;
+  char     buffer[BATCH_LENGTH + 1];
+  TEvent   events[EVENTS_PER_BATCH];
+  size_t   n;
+  uint32_t cursor = NO_CURSOR;
+  uint8_t  result;
+
+  // The events after the last one seen by the client are sent right away, or
+  // the current status if the client has fallen behind. The changes are pushed
+  // through the event stream (see handle_get_events) so the worker of the HTTP
+  // server is never blocked waiting for them
+  if (
+    httpd_req_get_url_query_str(request, buffer, sizeof(buffer)) == ESP_OK &&
+    httpd_query_key_value(buffer, "q", buffer, sizeof(buffer))    == ESP_OK
+  ) {
+    cursor = get_cursor(buffer);
+  }
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  httpd_resp_send_chunk(request, "[", 1);
+
+  for (bool is_first = true; true; is_first = false) {
+    n      = EVENTS_PER_BATCH;
+    result = ctl_get_events(&cursor, events, &n);
+
+    if (n == 0) {
+      break;
+    }
+
+    if (!is_first) {
+      httpd_resp_send_chunk(request, ",", 1);
     }
 
-    vTaskDelay(STATUS_READ_MS / portTICK_RATE_MS);
+    // Send the events without the brackets of the array
+    format_events(buffer, events, n, result == E_OVERRUN);
+
+    httpd_resp_send_chunk(request, buffer + 1, strlen(buffer) - 2);
   }
 
-  // Send the controller status to the client, which may have changed or not;
-  // but in any case send it as well as the corresponding friendly description
-  // and the flag indicating whether the controller is busy or not
+  httpd_resp_send_chunk(request, "]", 1);
 
-  if(read_idx == write_idx) {
-    idx = (read_idx == 0 ? EVENT_BUFFER_SIZE : read_idx) - 1;
-  } else {
-    idx = read_idx;
+  return httpd_resp_send_chunk(request, NULL, 0);
+}
+
+static void remove_push_client(void* client) {
+  ((TPushClient*) client)->is_used = false;
+}
+
+// Sends the events after the cursor of a client of the status push, in batches
+// identified by the sequence number of their last event
+//
+// @returns true, on success; false, if the events cannot be sent.
+static bool push_events(TPushClient* client) {
+  char    message[MESSAGE_LENGTH + 1];
+  TEvent  events[EVENTS_PER_BATCH];
+  size_t  n;
+  uint8_t result;
+  int     length;
+
+  while (true) {
+    n      = EVENTS_PER_BATCH;
+    result = ctl_get_events(&client->cursor, events, &n);
+
+    if (n == 0) {
+      return true;
+    }
+
+    length = sprintf(message, "id: %u\ndata: ", events[n - 1].sequence);
+
+    format_events(message + length, events, n, result == E_OVERRUN);
+
+    strcat(message, "\n\n");
+
+    // A send may be cut short by its timeout, so the rest is sent until the
+    // whole record is out, or the client is given up to keep the framing
+    length = strlen(message);
+
+    for (int m = 0, s; m < length; m += s) {
+      s = httpd_socket_send(http_server, client->socket_fd, &message[m], length - m, 0);
+
+      if (s <= 0) {
+        return false;
+      }
+    }
+  }
+}
+
+static esp_err_t handle_get_events(httpd_req_t* request) {
+  static const char header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "\r\n";
+
+  char           buffer[16 + 1];
+  TPushClient*   client       = NULL;
+  struct timeval send_timeout = { .tv_sec = 0, .tv_usec = PUSH_SEND_MS * 1000 };
 
-    if (++read_idx == EVENT_BUFFER_SIZE) {
-      read_idx = 0;
+  for (size_t i = 0; client == NULL && i < MAX_PUSH_CLIENTS; i++) {
+    if (!push_clients[i].is_used) {
+      client = &push_clients[i];
     }
   }
 
-  sprintf(
-    buffer,
-    "[{\"s\":%d,\"t\":\"%s\",\"b\":%d}]",
-    events[idx].is_powered,
-    events[idx].status_text,
-    events[idx].is_busy
+  if (client == NULL) {
+    httpd_resp_set_status(request, HTTPD_503);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  // The browser sends the sequence number of the last event it has seen when it
+  // reconnects to the stream
+  client->socket_fd = httpd_req_to_sockfd(request);
+  client->cursor    =
+    httpd_req_get_hdr_value_str(request, "Last-Event-ID", buffer, sizeof(buffer)) == ESP_OK
+    ? get_cursor(buffer)
+    : NO_CURSOR;
+
+  // The events are sent from the HTTP server task, so a client not reading them
+  // must not stall it for long - It is closed once a send times out
+  setsockopt(client->socket_fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+  // The response never ends so the headers are written as they are, followed by
+  // the events missed or the current status. The session is kept open once this
+  // handler returns and the events are pushed through its socket by push_event
+  if (httpd_send(request, header, sizeof(header) - 1) < 0 || !push_events(client)) {
+    return ESP_FAIL;
+  }
+
+  client->is_used   = true;
+
+  request->sess_ctx = client;
+  request->free_ctx = remove_push_client;
+
+  return ESP_OK;
+}
+
+// Sends the new events to all the clients of the status push - This runs in the
+// HTTP server task
+static void push_event(void* arg) {
+  size_t n_clients = 0;
+
+  is_push_queued = false;
+
+  for (size_t i = 0; i < MAX_PUSH_CLIENTS; i++) {
+    if (!push_clients[i].is_used) {
+      continue;
+    }
+
+    if (!push_events(&push_clients[i])) {
+      httpd_sess_trigger_close(http_server, push_clients[i].socket_fd);
+    } else {
+      n_clients++;
+    }
+  }
+
+  if (action_cycles != 0) {
+    last_push_us       = CYCLES_TO_US(soc_get_ccount() - action_cycles);
+    last_push_clients  = n_clients;
+    max_push_us        = last_push_us > max_push_us ? last_push_us : max_push_us;
+    total_push_us     += last_push_us;
+
+    n_pushes++;
+
+    action_cycles = 0;
+  }
+}
+
+// Waits for the events of the controller and queues the push of the new ones to
+// the HTTP server task, so the controller is never blocked on a client - Each
+// client reads the events from its own cursor, so a push already queued covers
+// any event written meanwhile
+static void push_events_task(void* arg) {
+  TEvent event;
+
+  while (true) {
+    if (ctl_read_event(subscriber, &event, PUSH_READ_MS) == E_NONE || is_push_queued) {
+      continue;
+    }
+
+    is_push_queued = true;
+
+    if (httpd_queue_work(http_server, push_event, NULL) != ESP_OK) {
+      is_push_queued = false;
+    }
+  }
+}
+
+static esp_err_t handle_get_tracking(httpd_req_t* request) {
+  char                 buffer[96 + 1];
+  TTrackingCalibration calibration;
+
+  ctl_get_tracking_calibration(&calibration);
+
+  sprintf(buffer,
+    "{\"valid\":%s,\"balance\":\"%x\",\"gain\":\"%x\",\"ms\":%u,\"probes\":%u}",
+    calibration.is_valid ? "true" : "false",
+    0x800 | calibration.balance,
+    0x820 | calibration.gain,
+    calibration.elapsed_ms,
+    calibration.n_probes
+  );
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  return httpd_resp_send(request, buffer, -1);
+}
+
+static esp_err_t handle_get_seek(httpd_req_t* request) {
+  char        buffer[96 + 1];
+  TSeekResult result;
+
+  ctl_get_seek_result(&result);
+
+  sprintf(buffer,
+    "{\"valid\":%s,\"target\":%u,\"reached\":%u,\"ms\":%u,\"iterations\":%u}",
+    result.is_valid ? "true" : "false",
+    result.target,
+    result.reached,
+    result.latency_ms,
+    result.n_iterations
   );
 
   httpd_resp_set_type(request, HTTPD_TYPE_JSON);
@@ -133,10 +425,439 @@ static esp_err_t handle_get_status(httpd_req_t* request) {
   return httpd_resp_send(request, buffer, -1);
 }
 
+static esp_err_t handle_post_seek(httpd_req_t* request) {
+  char        query[64 + 1];
+  char        value[8 + 1];
+  TSeekTarget target = { 0 };
+
+  // The target is either a track (t) or an absolute time given in minutes (m),
+  // seconds (s) and frames (f)
+  if (httpd_req_get_url_query_str(request, query, sizeof(query)) != ESP_OK) {
+    httpd_resp_set_status(request, HTTPD_400);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  if (httpd_query_key_value(query, "t", value, sizeof(value)) == ESP_OK) {
+    target.track = atoi(value);
+  } else if (httpd_query_key_value(query, "m", value, sizeof(value)) == ESP_OK) {
+    target.min   = atoi(value);
+
+    if (httpd_query_key_value(query, "s", value, sizeof(value)) == ESP_OK) {
+      target.sec   = atoi(value);
+    }
+
+    if (httpd_query_key_value(query, "f", value, sizeof(value)) == ESP_OK) {
+      target.frame = atoi(value);
+    }
+  }
+
+  if (target.track == 0 && target.min == 0 && target.sec == 0 && target.frame == 0) {
+    httpd_resp_set_status(request, HTTPD_400);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  if (ctl_seek(&target) != CTL_OK) {
+    httpd_resp_set_status(request, HTTPD_503);
+  }
+
+  return httpd_resp_send(request, NULL, 0);
+}
+
+static esp_err_t handle_get_scan(httpd_req_t* request) {
+  char       buffer[96 + 1];
+  TScanInfo  info;
+  TScanPoint point;
+
+  ctl_get_scan_info(&info);
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  sprintf(buffer,
+    "{\"complete\":%s,\"spacing\":%u,\"ms\":%u,\"points\":[",
+    info.is_complete ? "true" : "false",
+    info.spacing,
+    info.elapsed_ms
+  );
+
+  httpd_resp_send_chunk(request, buffer, -1);
+
+  // Send the error map indexed by the absolute time of each point, in frames
+  for (size_t i = 0; ctl_get_scan_point(i, &point); i++) {
+    sprintf(buffer,
+      "%s{\"t\":%u,\"r\":%d,\"l\":%u,\"n\":%u,\"c\":%u,\"f\":%u}",
+      i > 0 ? "," : "",
+      point.atime,
+      point.is_reached,
+      point.lock_ms,
+      point.n_frames,
+      point.crc_errors,
+      point.fok_dropouts
+    );
+
+    httpd_resp_send_chunk(request, buffer, -1);
+  }
+
+  httpd_resp_send_chunk(request, "]}", 2);
+
+  return httpd_resp_send_chunk(request, NULL, 0);
+}
+
+static esp_err_t handle_post_scan(httpd_req_t* request) {
+  char     query[64 + 1];
+  char     value[8 + 1];
+  uint16_t spacing_s = 0;
+  uint16_t dwell_ms  = 0;
+
+  // The spacing (s) in seconds and the dwell time (d) in mS are optional
+  if (httpd_req_get_url_query_str(request, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "s", value, sizeof(value)) == ESP_OK) {
+      spacing_s = atoi(value);
+    }
+
+    if (httpd_query_key_value(query, "d", value, sizeof(value)) == ESP_OK) {
+      dwell_ms  = atoi(value);
+    }
+  }
+
+  if (ctl_scan(spacing_s, dwell_ms) != CTL_OK) {
+    httpd_resp_set_status(request, HTTPD_503);
+  }
+
+  return httpd_resp_send(request, NULL, 0);
+}
+
+// Takes a command parsed while checking the session to replay
+static bool check_replay_command(const TReplayCommand* command, void* arg) {
+  return true;
+}
+
+static esp_err_t handle_post_replay(httpd_req_t* request) {
+  char          query[32 + 1];
+  char          value[8 + 1];
+  char          message[32 + 1];
+  char*         text;
+  size_t        size      = request->content_len;
+  uint16_t      speed_pct = 0;
+  uint8_t       result;
+  TReplayParser parser;
+
+  // The speed (x) in percent is optional
+  if (
+    httpd_req_get_url_query_str(request, query, sizeof(query))  == ESP_OK &&
+    httpd_query_key_value(query, "x", value, sizeof(value))     == ESP_OK
+  ) {
+    speed_pct = atoi(value);
+  }
+
+  // The session is received whole and replayed by the controller, so the HTTP
+  // server is not held while it is replayed - Longer sessions can be streamed
+  // through the console
+  if (size > MAX_REPLAY_LENGTH) {
+    httpd_resp_set_status(request, HTTPD_400);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  text = (char*) malloc(size + 1);
+
+  if (text == NULL) {
+    httpd_resp_set_status(request, HTTPD_500);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  for (int m = 0, s; m < size; m += s) {
+    s = httpd_req_recv(request, &text[m], size - m);
+
+    if (s <= 0) {
+      free(text);
+
+      httpd_resp_set_status(request, HTTPD_500);
+
+      return httpd_resp_send(request, NULL, 0);
+    }
+  }
+
+  text[size] = 0;
+
+  // The syntax is checked beforehand so it can be reported
+  rpl_init(&parser);
+
+  result = rpl_parse(&parser, text, size, check_replay_command, NULL);
+
+  if (result == RPL_OK) {
+    result = rpl_finish(&parser, check_replay_command, NULL);
+  }
+
+  if (result != RPL_OK) {
+    free(text);
+
+    sprintf(message, "Syntax error at line %u", parser.line);
+
+    httpd_resp_set_status(request, HTTPD_400);
+
+    return httpd_resp_send(request, message, -1);
+  }
+
+  // The text will be freed by the controller API
+  if (ctl_replay_text(speed_pct, text) != CTL_OK) {
+    httpd_resp_set_status(request, HTTPD_503);
+  }
+
+  return httpd_resp_send(request, NULL, 0);
+}
+
+static esp_err_t handle_get_recovery(httpd_req_t* request) {
+  char           buffer[160 + 1];
+  TRecoveryStats stats;
+
+  ctl_get_recovery_stats(&stats);
+
+  sprintf(buffer,
+    "{\"losses\":%u,\"recovered\":[%u,%u,%u],\"failed\":%u,"
+    "\"last_ms\":%u,\"max_ms\":%u,\"total_ms\":%u}",
+    stats.n_losses,
+    stats.n_recovered[RC_TRACKING],
+    stats.n_recovered[RC_FOCUS   ],
+    stats.n_recovered[RC_SEEK    ],
+    stats.n_failed,
+    stats.last_ms,
+    stats.max_ms,
+    stats.total_ms
+  );
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  return httpd_resp_send(request, buffer, -1);
+}
+
+static esp_err_t handle_get_timing(httpd_req_t* request) {
+  char         buffer[384 + 1];
+  TTimingStats stats;
+
+  ctl_get_timing_stats(&stats);
+
+  sprintf(buffer,
+    "{\"requests\":%u,\"last_request_us\":%u,\"max_request_us\":%u,\"total_request_us\":%u,"
+    "\"bursts\":%u,\"commands\":%u,\"total_burst_us\":%u,"
+    "\"last_burst\":{\"commands\":%u,\"us\":%u},"
+    "\"pushes\":%u,\"last_push\":{\"clients\":%u,\"us\":%u},\"max_push_us\":%u,\"total_push_us\":%u}",
+    stats.n_requests,
+    stats.last_request_us,
+    stats.max_request_us,
+    stats.total_request_us,
+    stats.n_bursts,
+    stats.n_commands,
+    stats.total_burst_us,
+    stats.last_burst_commands,
+    stats.last_burst_us,
+    n_pushes,
+    last_push_clients,
+    last_push_us,
+    max_push_us,
+    total_push_us
+  );
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  return httpd_resp_send(request, buffer, -1);
+}
+
+static esp_err_t handle_get_bus(httpd_req_t* request) {
+  char      buffer[192 + 1];
+  TBusStats stats;
+
+  bus_get_stats(&stats);
+
+  sprintf(buffer,
+    "{\"grants\":{\"subq\":%u,\"micom\":%u},\"deferred\":%u,\"missed\":%u,"
+    "\"max_wait_us\":%u,\"switches\":%u,\"switch_cycles\":%u,\"max_switch_cycles\":%u}",
+    stats.n_grants[B_SUBQ ],
+    stats.n_grants[B_MICOM],
+    stats.n_deferred,
+    stats.n_missed,
+    stats.max_wait_us,
+    stats.n_switches,
+    stats.switch_cycles,
+    stats.max_switch_cycles
+  );
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  return httpd_resp_send(request, buffer, -1);
+}
+
+static esp_err_t handle_get_latency(httpd_req_t* request) {
+  char     buffer[128 + 1];
+  TLatency latency;
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  httpd_resp_send_chunk(request, "[", 1);
+
+  // Send the completion times of every command and line recorded, in uS
+  for (size_t i = 0; lat_get(i, &latency); i++) {
+    sprintf(buffer,
+      "%s{\"command\":%u,\"line\":\"%s\",\"count\":%u,"
+      "\"min\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u}",
+      i > 0 ? "," : "",
+      latency.command,
+      latency.line == LAT_SENS ? "sens" : "fok",
+      latency.count,
+      latency.min,
+      latency.p50,
+      latency.p99,
+      latency.max
+    );
+
+    httpd_resp_send_chunk(request, buffer, -1);
+  }
+
+  httpd_resp_send_chunk(request, "]", 1);
+
+  return httpd_resp_send_chunk(request, NULL, 0);
+}
+
+static esp_err_t handle_post_latency(httpd_req_t* request) {
+  lat_reset();
+
+  return httpd_resp_send(request, NULL, 0);
+}
+
+static esp_err_t handle_get_trcnt(httpd_req_t* request) {
+  char            buffer[96 + 1];
+  TTrackCrossings crossings;
+
+  trc_get(&crossings);
+
+  sprintf(buffer,
+    "{\"count\":%u,\"rate\":%u,\"kick_count\":%u,\"kick_us\":%u}",
+    crossings.count,
+    crossings.rate,
+    crossings.kick_count,
+    crossings.kick_us
+  );
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  return httpd_resp_send(request, buffer, -1);
+}
+
+static esp_err_t handle_get_idle(httpd_req_t* request) {
+  char buffer[32 + 1];
+
+  sprintf(buffer, "{\"idle\":%u}", idle_get_percent());
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  return httpd_resp_send(request, buffer, -1);
+}
+
+static esp_err_t handle_get_profile(httpd_req_t* request) {
+  char          buffer[192 + 1];
+  TProfile      profile;
+  TProfileStats stats;
+
+  profile_get(&profile);
+  profile_get_stats(&stats);
+
+  // The fields of the profile come first, as POST takes them, followed by the
+  // ones only read
+  sprintf(buffer,
+    "{\"fb\":[\"%x\",\"%x\"],\"balance\":\"%x\",\"gain\":\"%x\",\"homing_ms\":%u,"
+    "\"loaded\":%s,\"last_homing_ms\":%u,\"slow_homings\":%u}",
+    profile.focus_bias[0],
+    profile.focus_bias[1],
+    0x800 | profile.balance,
+    0x820 | profile.gain,
+    profile.homing_ms,
+    stats.is_loaded ? "true" : "false",
+    stats.last_homing_ms,
+    stats.n_slow_homings
+  );
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  return httpd_resp_send(request, buffer, -1);
+}
+
+static esp_err_t handle_post_profile(httpd_req_t* request) {
+  char         buffer[192 + 1];
+  size_t       size = request->content_len;
+  TProfile     profile;
+  unsigned int balance;
+  unsigned int gain;
+  int          length = -1;
+  size_t       end    = size;
+
+  // The body contains the profile in the same format as it is returned by GET,
+  // with the fields in the same order; an empty body erases the stored profile
+  // so the default one is used again
+  if (size >= sizeof(buffer)) {
+    httpd_resp_set_status(request, HTTPD_400);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  for (int m = 0, s; m < size; m += s) {
+    s = httpd_req_recv(request, &buffer[m], size - m);
+
+    if (s <= 0) {
+      httpd_resp_set_status(request, HTTPD_500);
+
+      return httpd_resp_send(request, NULL, 0);
+    }
+  }
+
+  buffer[size] = 0;
+
+  if (size != 0) {
+    sscanf(buffer,
+      " { \"fb\" : [ \"%hx\" , \"%hx\" ] , \"balance\" : \"%x\" , \"gain\" : \"%x\" , \"homing_ms\" : %hu %n",
+      &profile.focus_bias[0],
+      &profile.focus_bias[1],
+      &balance,
+      &gain,
+      &profile.homing_ms,
+      &length
+    );
+
+    while (end > 0 && isspace((unsigned char) buffer[end - 1])) {
+      end--;
+    }
+
+    // The fields only read, which GET returns after the ones of the profile,
+    // are ignored. The balance and the gain are given as the commands they are
+    // sent as
+    if (
+      length < 0 || end == 0 || buffer[end - 1] != '}'    ||
+      (buffer[length] != ',' && length != end - 1)        ||
+      balance - 0x800 > 0x1F || gain - 0x820 > 0x1F
+    ) {
+      httpd_resp_set_status(request, HTTPD_400);
+
+      return httpd_resp_send(request, NULL, 0);
+    }
+
+    profile.balance = balance - 0x800;
+    profile.gain    = gain    - 0x820;
+  }
+
+  if (profile_store(size == 0 ? NULL : &profile) != 0) {
+    httpd_resp_set_status(request, HTTPD_400);
+  }
+
+  return httpd_resp_send(request, NULL, 0);
+}
+
 static esp_err_t handle_post_action(httpd_req_t* request) {
   char   buffer[64 + 1];
   size_t buffer_size = sizeof(buffer) / sizeof(char);
 
+  action_cycles = soc_get_ccount();
+
   // If the request is valid then execute the requested action and return
   // the 200/OK response immediately
   if (
@@ -145,7 +866,9 @@ static esp_err_t handle_post_action(httpd_req_t* request) {
   ) {
     for (size_t i = 0; i < sizeof(actions) / sizeof(TAction); i++) {
       if (buffer[0] == actions[i].id) {
-        actions[i].fn();
+        if (actions[i].fn() != CTL_OK) {
+          httpd_resp_set_status(request, HTTPD_503);
+        }
 
         return httpd_resp_send(request, NULL, 0);
       }
@@ -197,7 +920,108 @@ static esp_err_t handle_post_commands(httpd_req_t* request) {
   }
 
   // Run the commands - The buffer will be freed by the controller API
-  ctl_run_micom_commands(length, (uint16_t*) buffer);
+  if (ctl_run_micom_commands(length, (uint16_t*) buffer, handle_micom_results) != CTL_OK) {
+    httpd_resp_set_status(request, HTTPD_503);
+  }
+
+  return httpd_resp_send(request, NULL, 0);
+}
+
+static esp_err_t handle_get_script(httpd_req_t* request) {
+  char      buffer[32 + 1];
+  uint32_t* code;
+  size_t    n;
+
+  if (
+    httpd_req_get_url_query_str(request, buffer, sizeof(buffer)) != ESP_OK ||
+    httpd_query_key_value(buffer, "n", buffer, sizeof(buffer))   != ESP_OK ||
+    !script_is_known(buffer)
+  ) {
+    httpd_resp_set_status(request, HTTPD_400);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  code = (uint32_t*) malloc(SCRIPT_MAX_LENGTH * sizeof(uint32_t));
+
+  if (code == NULL) {
+    httpd_resp_set_status(request, HTTPD_500);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  n = script_load(buffer, code);
+
+  httpd_resp_set_type(request, HTTPD_TYPE_JSON);
+
+  // Send the instructions of the script that would be run, either the uploaded
+  // one or the built-in one
+  httpd_resp_send_chunk(request, "[", 1);
+
+  for (size_t i = 0; i < n; i++) {
+    sprintf(buffer, "\"%08x\"", code[i]);
+
+    httpd_resp_send_chunk(request, buffer, -1);
+
+    if (i + 1 < n) {
+      httpd_resp_send_chunk(request, ",", 1);
+    }
+  }
+
+  httpd_resp_send_chunk(request, "]", 1);
+
+  free(code);
+
+  return httpd_resp_send_chunk(request, NULL, 0);
+}
+
+static esp_err_t handle_post_script(httpd_req_t* request) {
+  char      name[32 + 1];
+  uint32_t* code;
+  size_t    size = request->content_len;
+  int32_t   status;
+
+  // The body contains the instructions of the script; an empty body erases the
+  // uploaded script so the built-in one is used again
+  if (
+    httpd_req_get_url_query_str(request, name, sizeof(name)) != ESP_OK ||
+    httpd_query_key_value(name, "n", name, sizeof(name))     != ESP_OK ||
+    !script_is_known(name)                                              ||
+    size % sizeof(uint32_t) != 0                                        ||
+    size > SCRIPT_MAX_LENGTH * sizeof(uint32_t)
+  ) {
+    httpd_resp_set_status(request, HTTPD_400);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  code = (uint32_t*) malloc(SCRIPT_MAX_LENGTH * sizeof(uint32_t));
+
+  if (code == NULL) {
+    httpd_resp_set_status(request, HTTPD_500);
+
+    return httpd_resp_send(request, NULL, 0);
+  }
+
+  for (int m = 0, s; m < size; m += s) {
+    s = httpd_req_recv(request, &((char*) code)[m], size - m);
+
+    if (s <= 0) {
+      free(code);
+
+      httpd_resp_set_status(request, HTTPD_500);
+
+      return httpd_resp_send(request, NULL, 0);
+    }
+  }
+
+  status = script_store(name, code, size / sizeof(uint32_t));
+
+  free(code);
+
+  if (status != 0) {
+    httpd_resp_set_status(request, HTTPD_400);
+  }
 
   return httpd_resp_send(request, NULL, 0);
 }
@@ -218,9 +1042,6 @@ static esp_err_t set_up_wifi() {
     // Create the default event loop required for WiFi service
     (status = esp_event_loop_create_default())                != ESP_OK ||
 
-    // Initialize the storage system, so it's available to other services
-    (status = nvs_flash_init())                               != ESP_OK ||
-
     // Update the DHCP configuration for the AP interface
     (status = tcpip_adapter_dhcps_stop(TCPIP_ADAPTER_IF_AP))  != ESP_OK ||
     (status = tcpip_adapter_set_ip_info(
@@ -245,7 +1066,8 @@ static esp_err_t set_up_http() {
   esp_err_t      status;
 
   httpd_config_t httpd_configuration = HTTPD_DEFAULT_CONFIG();
-  httpd_handle_t http_server         = NULL;
+
+  httpd_configuration.max_uri_handlers = 26;
 
   if ((status = httpd_start(&http_server, &httpd_configuration)) != ESP_OK) {
     ESP_LOGE(module_id,
@@ -256,8 +1078,27 @@ static esp_err_t set_up_http() {
       { .method = HTTP_GET , .uri = "/"        , .handler = handle_get_resource  },
       { .method = HTTP_GET , .uri = "/actions" , .handler = handle_get_actions   },
       { .method = HTTP_GET , .uri = "/status"  , .handler = handle_get_status    },
+      { .method = HTTP_GET , .uri = "/events"  , .handler = handle_get_events    },
+      { .method = HTTP_GET , .uri = "/commands", .handler = handle_get_commands  },
       { .method = HTTP_POST, .uri = "/action"  , .handler = handle_post_action   },
       { .method = HTTP_POST, .uri = "/commands", .handler = handle_post_commands },
+      { .method = HTTP_GET , .uri = "/script"  , .handler = handle_get_script    },
+      { .method = HTTP_POST, .uri = "/script"  , .handler = handle_post_script   },
+      { .method = HTTP_GET , .uri = "/tracking", .handler = handle_get_tracking  },
+      { .method = HTTP_GET , .uri = "/profile" , .handler = handle_get_profile   },
+      { .method = HTTP_POST, .uri = "/profile" , .handler = handle_post_profile  },
+      { .method = HTTP_GET , .uri = "/idle"    , .handler = handle_get_idle      },
+      { .method = HTTP_GET , .uri = "/seek"    , .handler = handle_get_seek      },
+      { .method = HTTP_POST, .uri = "/seek"    , .handler = handle_post_seek     },
+      { .method = HTTP_GET , .uri = "/recovery", .handler = handle_get_recovery  },
+      { .method = HTTP_GET , .uri = "/scan"    , .handler = handle_get_scan      },
+      { .method = HTTP_POST, .uri = "/scan"    , .handler = handle_post_scan     },
+      { .method = HTTP_GET , .uri = "/trcnt"   , .handler = handle_get_trcnt     },
+      { .method = HTTP_GET , .uri = "/bus"     , .handler = handle_get_bus       },
+      { .method = HTTP_POST, .uri = "/replay"  , .handler = handle_post_replay   },
+      { .method = HTTP_GET , .uri = "/latency" , .handler = handle_get_latency   },
+      { .method = HTTP_POST, .uri = "/latency" , .handler = handle_post_latency  },
+      { .method = HTTP_GET , .uri = "/timing"  , .handler = handle_get_timing    },
     };
 
     for (size_t i = 0; i < sizeof(handlers) / sizeof(httpd_uri_t); i++) {
@@ -289,17 +1130,18 @@ static esp_err_t set_up_http() {
 void wifi_stop() {
   esp_wifi_stop                ();
   tcpip_adapter_stop           (TCPIP_ADAPTER_IF_AP);
-  nvs_flash_deinit             ();
   esp_event_loop_delete_default();
 }
 
 int32_t wifi_start() {
   if (set_up_wifi() == ESP_OK) {
-    if (set_up_http() != ESP_OK || ctl_add_listener(handle_ctl_update) != 0) {
+    if ((subscriber = ctl_subscribe()) < 0 || set_up_http() != ESP_OK) {
       wifi_stop();
 
       return -1;
     }
+
+    xTaskCreate(push_events_task, "wifiPush", 2048, NULL, 1, NULL);
   }
 
   return 0;
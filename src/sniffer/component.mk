@@ -2,3 +2,6 @@
 # "main" pseudo-component makefile.
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
+
+# The MICOM command table is shared with the sender
+COMPONENT_PRIV_INCLUDEDIRS := ../micom
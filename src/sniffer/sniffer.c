@@ -1,3 +1,5 @@
+#include "micom.h"
+
 // ESP8266
 #include "esp8266/gpio_struct.h"
 #include "driver/gpio.h"
@@ -20,7 +22,9 @@
 // The size of the circular buffer
 #define BUFFER_SIZE 2048
 
-static DRAM_ATTR uint32_t buffer[BUFFER_SIZE];  // The circular buffer
+static DRAM_ATTR uint32_t buffer[BUFFER_SIZE];  // The circular buffer - Each word holds the
+                                                // command in the lower 16 bits and its
+                                                // length in bits above them
 static IRAM_ATTR bool     buffer_full;          // Indicates if the circular buffer is full
 static IRAM_ATTR size_t   read_index;           // The read index of the circular buffer
 static IRAM_ATTR size_t   write_index;          // The write index of the circular buffer
@@ -49,7 +53,7 @@ static void IRAM_ATTR handle_int(void* arg) {
   }
 
   if (status & (1UL << XLT_LINE)) {
-    buffer[write_index] = data;
+    buffer[write_index] = (ticks << 16) | (data & 0xFFFF);
 
     ticks = 0;
     data  = 0;
@@ -104,7 +108,17 @@ void run_sniffer() {
     }
 
     while (read_index < (write_index < read_index ? BUFFER_SIZE : write_index)) {
-      printf("%04x ", buffer[read_index++]);
+      uint32_t word    = buffer[read_index++];
+      uint16_t command = word & 0xFFFF;
+      uint8_t  bits    = word >> 16;
+
+      // The length is only written if it is not the one of the MICOM command
+      // table, e.g. 008/12, so the session can be replayed as captured
+      if (bits == micom_bits(command)) {
+        printf("%04x ", command);
+      } else {
+        printf("%04x/%u ", command, bits);
+      }
     }
 
     if (read_index == BUFFER_SIZE) {